@@ -0,0 +1,68 @@
+/*
+ * alloc.c
+ *
+ * Allocation counting, see alloc.h. The allocator entry points defined here take the place of
+ * libc's for the whole process, and forward to glibc's own implementations.
+ */
+
+#include "alloc.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+extern void* __libc_malloc (size_t size);
+extern void* __libc_calloc (size_t count, size_t size);
+extern void* __libc_realloc (void *ptr, size_t size);
+extern void* __libc_memalign (size_t alignment, size_t size);
+
+static atomic_bool   counting;
+static atomic_ulong  allocations;
+
+static void count_allocation (void)
+{
+    if (atomic_load_explicit (&counting, memory_order_relaxed)) {
+        atomic_fetch_add_explicit (&allocations, 1, memory_order_relaxed);
+    }
+}
+
+void alloc_count_enable (bool enabled)
+{
+    atomic_store (&counting, enabled);
+}
+
+unsigned long alloc_count_get (void)
+{
+    return atomic_load (&allocations);
+}
+
+void* malloc (size_t size)
+{
+    count_allocation ();
+    return __libc_malloc (size);
+}
+
+void* calloc (size_t count, size_t size)
+{
+    count_allocation ();
+    return __libc_calloc (count, size);
+}
+
+void* realloc (void *ptr, size_t size)
+{
+    count_allocation ();
+    return __libc_realloc (ptr, size);
+}
+
+int posix_memalign (void **out_ptr, size_t alignment, size_t size)
+{
+    count_allocation ();
+
+    void *ptr = __libc_memalign (alignment, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+
+    *out_ptr = ptr;
+    return 0;
+}
@@ -0,0 +1,15 @@
+/*
+ * alloc.h
+ *
+ * Counts heap allocations made anywhere in the process, library included, while counting is
+ * switched on. Used to check that steady-state uploads never allocate.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+extern void alloc_count_enable (bool enabled);
+
+// Returns the number of malloc, calloc, realloc and posix_memalign calls made while enabled
+extern unsigned long alloc_count_get (void);
@@ -0,0 +1,765 @@
+/*
+ * Benchmarks for the conversion and upload hot paths
+ *
+ * Each command runs one case for a fixed time budget and reports ns/frame and frames/s.
+ * Device cases run against the mock backend, so no keypad is needed.
+ */
+
+#include <infinitton/infinitton.h>
+
+#include "alloc.h"
+#include "convert.h"
+#include "wire.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// How long each case runs for
+#define BENCH_BUDGET_NSEC  (500 * 1000 * 1000ULL)
+
+static void bench_convert (char **argv);
+static void bench_update (char **argv);
+static void bench_churn (char **argv);
+static void bench_encode (char **argv);
+static void bench_panel (char **argv);
+static void bench_bmp (char **argv);
+static void bench_atlas (char **argv);
+static void bench_partial (char **argv);
+static void bench_alloc (char **argv);
+
+typedef struct {
+    const char *name;
+    void (*function)(char**);
+} command_t;
+
+// Each command is also registered as a benchmark in meson.build, keep the two in step
+static command_t __commands[] = {
+    { "convert", bench_convert },
+    { "update", bench_update },
+    { "churn",  bench_churn },
+    { "encode", bench_encode },
+    { "panel",  bench_panel },
+    { "bmp",    bench_bmp },
+    { "atlas",  bench_atlas },
+    { "partial", bench_partial },
+    { "alloc",  bench_alloc },
+};
+
+static void print_usage (const char *progname)
+{
+    fprintf (stderr, "Usage: %s [command] [arguments...]\n", progname);
+    fprintf (stderr, "Commands: \n");
+    fprintf (stderr, "\tconvert: each row conversion and compare kernel, checked against the scalar one\n");
+    fprintf (stderr, "\tupdate: infpixmap_update_with_surface, upright and turned\n");
+    fprintf (stderr, "\tchurn: infpixmap_create/infpixmap_free, and through a pool\n");
+    fprintf (stderr, "\tencode: single key uploads, encoded, wire layout and from key surfaces, unpaced\n");
+    fprintf (stderr, "\tpanel: full-panel refresh through infdevice_set_pixmaps and a canvas\n");
+    fprintf (stderr, "\tbmp [bmp_file]: infpixmap_open_file\n");
+    fprintf (stderr, "\tatlas [icon_dir]: page switches, loading each icon against an atlas\n");
+    fprintf (stderr, "\tpartial: half-frame uploads, checked by decoding the reports sent\n");
+    fprintf (stderr, "\talloc: synchronous, submitted and batched uploads, checked to never allocate\n");
+}
+
+static uint64_t now_ns (void)
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void report (const char *name, unsigned long frames, uint64_t elapsed_ns)
+{
+    const double ns_per_frame = (double) elapsed_ns / frames;
+    printf ("%-32s %12.0f ns/frame %12.1f frames/s\n", name, ns_per_frame, 1e9 / ns_per_frame);
+}
+
+static infdevice_t* open_mock_device (void)
+{
+    infdevice_t *device = infdevice_open_with_backend (INF_BACKEND_MOCK);
+    if (!device) {
+        fprintf (stderr, "Could not open mock device\n");
+        exit (1);
+    }
+
+    return device;
+}
+
+static void fill_surface (cairo_surface_t *surface, unsigned char seed)
+{
+    cairo_surface_flush (surface);
+
+    unsigned char *data = cairo_image_surface_get_data (surface);
+    const size_t size = cairo_image_surface_get_stride (surface) * cairo_image_surface_get_height (surface);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (unsigned char) (i * 31 + seed);
+    }
+
+    cairo_surface_mark_dirty (surface);
+}
+
+// How the kernels are driven over the source image: where output row 0 starts, and the
+// distance between output rows and between the pixels of a row
+typedef struct {
+    const char *name;
+    ptrdiff_t   origin;
+    ptrdiff_t   row_step;
+    ptrdiff_t   col_step;
+} convert_walk_t;
+
+static void bench_convert (char **argv)
+{
+    enum { SRC_ROW_SIZE = ICON_WIDTH * 4, DST_ROW_SIZE = ICON_WIDTH * 3, GUARD_SIZE = 64 };
+
+    unsigned int num_kernels = 0;
+    const convert_kernel_t *kernels = convert_get_kernels (&num_kernels);
+
+    // Rows read backwards are the upright case, columns are quarter turns
+    const convert_walk_t walks[] = {
+        { "rows", SRC_ROW_SIZE - 4, SRC_ROW_SIZE, -4 },
+        { "rows mirrored", 0, SRC_ROW_SIZE, 4 },
+        { "cols", 0, 4, SRC_ROW_SIZE },
+        { "cols reversed", ICON_HEIGHT * SRC_ROW_SIZE - 4, -4, -SRC_ROW_SIZE },
+    };
+    const unsigned int num_walks = sizeof (walks) / sizeof (walks[0]);
+
+    // Random pixels, unused byte included, so any channel mixup shows
+    static unsigned char src[ICON_HEIGHT * SRC_ROW_SIZE];
+    srand (1);
+    for (unsigned int i = 0; i < sizeof (src); i++) {
+        src[i] = rand () & 0xff;
+    }
+
+    for (unsigned int w = 0; w < num_walks; w++) {
+        const convert_walk_t *walk = &walks[w];
+
+        // The first kernel is the portable one, everything else has to match it exactly
+        static unsigned char expected[ICON_HEIGHT * DST_ROW_SIZE];
+        for (unsigned int row = 0; row < ICON_HEIGHT; row++) {
+            kernels[0].convert_row (expected + row * DST_ROW_SIZE,
+                                    src + walk->origin + row * walk->row_step, walk->col_step);
+        }
+
+        for (unsigned int k = 0; k < num_kernels; k++) {
+            static unsigned char converted[ICON_HEIGHT * DST_ROW_SIZE + GUARD_SIZE];
+            memset (converted, 0xa5, sizeof (converted));
+
+            for (unsigned int row = 0; row < ICON_HEIGHT; row++) {
+                kernels[k].convert_row (converted + row * DST_ROW_SIZE,
+                                        src + walk->origin + row * walk->row_step, walk->col_step);
+            }
+
+            bool guard_intact = true;
+            for (unsigned int i = 0; i < GUARD_SIZE; i++) {
+                guard_intact &= (converted[ICON_HEIGHT * DST_ROW_SIZE + i] == 0xa5);
+            }
+
+            if (memcmp (converted, expected, sizeof (expected)) != 0 || !guard_intact) {
+                fprintf (stderr, "Kernel %s doesn't match the scalar output for %s\n",
+                         kernels[k].name, walk->name);
+                exit (1);
+            }
+
+            unsigned long frames = 0;
+            const uint64_t start = now_ns ();
+            uint64_t elapsed = 0;
+            for (; elapsed < BENCH_BUDGET_NSEC; frames++) {
+                for (unsigned int row = 0; row < ICON_HEIGHT; row++) {
+                    kernels[k].convert_row (converted + row * DST_ROW_SIZE,
+                                            src + walk->origin + row * walk->row_step, walk->col_step);
+                }
+                elapsed = now_ns () - start;
+            }
+
+            char name[64];
+            snprintf (name, sizeof (name), "convert %s (%s)", walk->name, kernels[k].name);
+            report (name, frames, elapsed);
+        }
+    }
+
+    // Damage detection: a tile compared with an identical copy, the worst case as nothing
+    // stops it early. Only the unused byte differs, which must not count.
+    static unsigned char copy[sizeof (src)];
+    for (unsigned int i = 0; i < sizeof (src); i++) {
+        copy[i] = (i % 4 == 3) ? ~src[i] : src[i];
+    }
+
+    for (unsigned int k = 0; k < num_kernels; k++) {
+        // Every length a kernel may see, with a change at every position
+        for (unsigned int count = 1; count <= ICON_WIDTH; count++) {
+            bool matches = kernels[k].pixels_equal (src, copy, count);
+            for (unsigned int i = 0; i < count * 4 && matches; i++) {
+                if (i % 4 == 3) continue;
+
+                copy[i] ^= 0x10;
+                matches = !kernels[k].pixels_equal (src, copy, count);
+                copy[i] ^= 0x10;
+            }
+
+            if (!matches) {
+                fprintf (stderr, "Kernel %s compares %u pixels wrongly\n", kernels[k].name, count);
+                exit (1);
+            }
+        }
+
+        // Counting the equal rows keeps the comparisons from being optimized away
+        unsigned long frames = 0;
+        unsigned int equal_rows = 0;
+        const uint64_t start = now_ns ();
+        uint64_t elapsed = 0;
+        for (; elapsed < BENCH_BUDGET_NSEC; frames++) {
+            for (unsigned int row = 0; row < ICON_HEIGHT; row++) {
+                equal_rows += kernels[k].pixels_equal (src + row * SRC_ROW_SIZE,
+                                                       copy + row * SRC_ROW_SIZE, ICON_WIDTH);
+            }
+            elapsed = now_ns () - start;
+        }
+
+        char name[64];
+        snprintf (name, sizeof (name), "compare tile (%s)", kernels[k].name);
+        report (name, equal_rows / ICON_HEIGHT, elapsed);
+    }
+}
+
+static void bench_update_pixmap (const char      *name,
+                                 infpixmap_t     *pixmap,
+                                 cairo_surface_t *surface,
+                                 inforientation_t orientation)
+{
+    unsigned long frames = 0;
+    const uint64_t start = now_ns ();
+    uint64_t elapsed = 0;
+    for (; elapsed < BENCH_BUDGET_NSEC; frames++) {
+        infpixmap_update_with_surface_oriented (pixmap, surface, orientation);
+        elapsed = now_ns () - start;
+    }
+
+    report (name, frames, elapsed);
+}
+
+static void bench_update (char **argv)
+{
+    cairo_surface_t *surface = infpixmap_create_surface ();
+    fill_surface (surface, 0);
+
+    infpixmap_t *pixmap = infpixmap_create ();
+    bench_update_pixmap ("update_with_surface (bmp)", pixmap, surface, INF_ORIENTATION_0);
+    infpixmap_free (pixmap);
+
+    pixmap = infpixmap_create_wire ();
+    bench_update_pixmap ("update_with_surface (wire)", pixmap, surface, INF_ORIENTATION_0);
+    bench_update_pixmap ("update_with_surface (wire, 90)", pixmap, surface, INF_ORIENTATION_90);
+    infpixmap_free (pixmap);
+
+    cairo_surface_destroy (surface);
+}
+
+static void bench_churn (char **argv)
+{
+    infpixmap_t* (*constructors[]) () = { infpixmap_create, infpixmap_create_wire };
+    const char *names[] = { "create/free (bmp)", "create/free (wire)" };
+
+    for (unsigned int i = 0; i < 2; i++) {
+        unsigned long frames = 0;
+        const uint64_t start = now_ns ();
+        uint64_t elapsed = 0;
+        for (; elapsed < BENCH_BUDGET_NSEC; frames++) {
+            infpixmap_free (constructors[i] ());
+            elapsed = now_ns () - start;
+        }
+
+        report (names[i], frames, elapsed);
+    }
+
+    infpixmap_pool_t *pool = infpixmap_pool_create (1, true);
+
+    unsigned long frames = 0;
+    const uint64_t start = now_ns ();
+    uint64_t elapsed = 0;
+    for (; elapsed < BENCH_BUDGET_NSEC; frames++) {
+        infpixmap_free (infpixmap_pool_get (pool));
+        elapsed = now_ns () - start;
+    }
+
+    report ("pool get/free (wire)", frames, elapsed);
+    infpixmap_pool_free (pool);
+}
+
+static void bench_upload_pixmap (const char *name, infdevice_t *device, infpixmap_t *pixmap)
+{
+    unsigned long frames = 0;
+    const uint64_t start = now_ns ();
+    uint64_t elapsed = 0;
+    for (; elapsed < BENCH_BUDGET_NSEC; frames++) {
+        // Same frame every time, so force it out
+        infdevice_invalidate_keys (device, INF_KEY_0);
+        infdevice_set_pixmap_for_key_id (device, INF_KEY_0, pixmap);
+        elapsed = now_ns () - start;
+    }
+
+    report (name, frames, elapsed);
+}
+
+// Drawing, converting and uploading a key through a pixmap, against the device's key surface
+static void bench_render (const char *name, infdevice_t *device, bool key_surface)
+{
+    cairo_surface_t *surface = key_surface ? infdevice_get_key_surface (device, INF_KEY_0)
+                                           : infpixmap_create_surface ();
+    infpixmap_t *pixmap = infpixmap_create_wire ();
+
+    unsigned long frames = 0;
+    const uint64_t start = now_ns ();
+    uint64_t elapsed = 0;
+    for (; elapsed < BENCH_BUDGET_NSEC; frames++) {
+        fill_surface (surface, frames);
+
+        if (key_surface) {
+            infdevice_upload_key_surface (device, INF_KEY_0);
+        } else {
+            infdevice_update_pixmap_with_surface (device, pixmap, surface);
+            infdevice_set_pixmap_for_key_id (device, INF_KEY_0, pixmap);
+        }
+        elapsed = now_ns () - start;
+    }
+
+    report (name, frames, elapsed);
+
+    infpixmap_free (pixmap);
+    if (!key_surface) {
+        cairo_surface_destroy (surface);
+    }
+}
+
+static void bench_encode (char **argv)
+{
+    infdevice_t *device = open_mock_device ();
+    infdevice_set_pacing (device, INF_PACING_DEADLINE, 0);
+
+    cairo_surface_t *surface = infpixmap_create_surface ();
+    fill_surface (surface, 0);
+
+    // The difference between the two is the cost of encoding reports
+    infpixmap_t *pixmap = infpixmap_create ();
+    infpixmap_update_with_surface (pixmap, surface);
+    bench_upload_pixmap ("upload, unpaced (bmp)", device, pixmap);
+    infpixmap_free (pixmap);
+
+    pixmap = infpixmap_create_wire ();
+    infpixmap_update_with_surface (pixmap, surface);
+    bench_upload_pixmap ("upload, unpaced (wire)", device, pixmap);
+    infpixmap_free (pixmap);
+
+    bench_render ("render + upload (pixmap)", device, false);
+    bench_render ("render + upload (key surface)", device, true);
+
+    cairo_surface_destroy (surface);
+    infdevice_close (device);
+}
+
+static void bench_panel_pacing (const char *name, infdevice_t *device, unsigned int delay_usec)
+{
+    infdevice_set_pacing (device, INF_PACING_DEADLINE, delay_usec);
+
+    cairo_surface_t *surface = infpixmap_create_surface ();
+    infpixmap_t *pixmaps[2][INF_NUM_KEYS];
+    infdevice_update_t updates[2][INF_NUM_KEYS];
+    for (unsigned int set = 0; set < 2; set++) {
+        for (unsigned int keynum = 0; keynum < INF_NUM_KEYS; keynum++) {
+            fill_surface (surface, set * INF_NUM_KEYS + keynum);
+
+            pixmaps[set][keynum] = infpixmap_create_wire ();
+            infpixmap_update_with_surface (pixmaps[set][keynum], surface);
+            updates[set][keynum] = (infdevice_update_t) {
+                .key_id = infkey_num_to_key (keynum),
+                .pixmap = pixmaps[set][keynum]
+            };
+        }
+    }
+
+    // Alternate between two sets of contents, so every key changes on every refresh
+    unsigned long frames = 0;
+    const uint64_t start = now_ns ();
+    uint64_t elapsed = 0;
+    for (; elapsed < BENCH_BUDGET_NSEC; frames++) {
+        infdevice_set_pixmaps (device, updates[frames % 2], INF_NUM_KEYS);
+        elapsed = now_ns () - start;
+    }
+
+    report (name, frames, elapsed);
+
+    for (unsigned int set = 0; set < 2; set++) {
+        for (unsigned int keynum = 0; keynum < INF_NUM_KEYS; keynum++) {
+            infpixmap_free (pixmaps[set][keynum]);
+        }
+    }
+    cairo_surface_destroy (surface);
+}
+
+// Presents a canvas, either redrawn with new contents every time or left as it was
+static void bench_panel_canvas (const char *name, infdevice_t *device, bool changing)
+{
+    infdevice_set_pacing (device, INF_PACING_DEADLINE, 0);
+    infdevice_set_orientation (device, INF_ORIENTATION_90);
+
+    infcanvas_t *canvas = infcanvas_create (device);
+    cairo_surface_t *surface = infcanvas_get_surface (canvas);
+
+    unsigned long frames = 0;
+    const uint64_t start = now_ns ();
+    uint64_t elapsed = 0;
+    for (; elapsed < BENCH_BUDGET_NSEC; frames++) {
+        if (changing || frames == 0) {
+            fill_surface (surface, frames);
+        }
+
+        infcanvas_present (canvas);
+        elapsed = now_ns () - start;
+    }
+
+    report (name, frames, elapsed);
+
+    infcanvas_free (canvas);
+    infdevice_set_orientation (device, INF_ORIENTATION_0);
+}
+
+static void bench_panel (char **argv)
+{
+    infdevice_t *device = open_mock_device ();
+
+    bench_panel_pacing ("panel refresh, unpaced", device, 0);
+    bench_panel_pacing ("panel refresh, 1500us pacing", device, 1500);
+    bench_panel_canvas ("canvas present, all changed", device, true);
+    bench_panel_canvas ("canvas present, unchanged", device, false);
+
+    infdevice_close (device);
+}
+
+static void bench_bmp (char **argv)
+{
+    const char *bmp_path = argv[1];
+    if (bmp_path == NULL) {
+        print_usage ("benchmarks");
+        return;
+    }
+
+    unsigned long frames = 0;
+    const uint64_t start = now_ns ();
+    uint64_t elapsed = 0;
+    for (; elapsed < BENCH_BUDGET_NSEC; frames++) {
+        infpixmap_t *pixmap = infpixmap_open_file (bmp_path);
+        if (!pixmap) {
+            fprintf (stderr, "Unable to open BMP file\n");
+            exit (1);
+        }
+
+        infpixmap_free (pixmap);
+        elapsed = now_ns () - start;
+    }
+
+    report ("open_file (bmp)", frames, elapsed);
+}
+
+// Shows pages of icons from the atlas on every key in turn, either straight from the atlas or
+// by opening each icon's file as it is shown, as if there were no atlas
+static void bench_atlas_pages (const char  *name,
+                               infdevice_t *device,
+                               infatlas_t  *atlas,
+                               const char  *dir_path)
+{
+    const size_t count = infatlas_get_count (atlas);
+    infdevice_update_t updates[INF_NUM_KEYS];
+
+    unsigned long frames = 0;
+    const uint64_t start = now_ns ();
+    uint64_t elapsed = 0;
+    for (; elapsed < BENCH_BUDGET_NSEC; frames++) {
+        for (unsigned int keynum = 0; keynum < INF_NUM_KEYS; keynum++) {
+            const int id = (frames * INF_NUM_KEYS + keynum) % count;
+
+            infpixmap_t *pixmap = infatlas_get_pixmap (atlas, id);
+            if (dir_path != NULL) {
+                char path[4096];
+                snprintf (path, sizeof (path), "%s/%s.bmp", dir_path, infatlas_get_name (atlas, id));
+                pixmap = infpixmap_open_file (path);
+                if (!pixmap) {
+                    fprintf (stderr, "Unable to open %s, only .bmp icons are compared\n", path);
+                    exit (1);
+                }
+            }
+
+            updates[keynum] = (infdevice_update_t) {
+                .key_id = infkey_num_to_key (keynum),
+                .pixmap = pixmap
+            };
+        }
+
+        infdevice_set_pixmaps (device, updates, INF_NUM_KEYS);
+
+        // Views into the atlas are left alone by this
+        for (unsigned int keynum = 0; keynum < INF_NUM_KEYS; keynum++) {
+            infpixmap_free (updates[keynum].pixmap);
+        }
+
+        elapsed = now_ns () - start;
+    }
+
+    report (name, frames, elapsed);
+}
+
+static void bench_atlas (char **argv)
+{
+    const char *dir_path = argv[1];
+    if (dir_path == NULL) {
+        print_usage ("benchmarks");
+        return;
+    }
+
+    const uint64_t start = now_ns ();
+    infatlas_t *atlas = infatlas_load_directory (dir_path);
+    if (!atlas || infatlas_get_count (atlas) == 0) {
+        fprintf (stderr, "No icons found in %s\n", dir_path);
+        exit (1);
+    }
+
+    printf ("loaded %zu icons in %.1f ms\n", infatlas_get_count (atlas), (now_ns () - start) / 1e6);
+
+    infdevice_t *device = open_mock_device ();
+    infdevice_set_pacing (device, INF_PACING_DEADLINE, 0);
+
+    bench_atlas_pages ("page switch (open_file)", device, atlas, dir_path);
+    bench_atlas_pages ("page switch (atlas)", device, atlas, NULL);
+    infdevice_close (device);
+
+    infatlas_free (atlas);
+}
+
+// Changes the rows of `surface` from `first_row` on, `num_rows` of them
+static void fill_rows (cairo_surface_t *surface, unsigned int first_row, unsigned int num_rows,
+                       unsigned char seed)
+{
+    cairo_surface_flush (surface);
+
+    const int stride = cairo_image_surface_get_stride (surface);
+    unsigned char *data = cairo_image_surface_get_data (surface) + first_row * stride;
+    for (size_t i = 0; i < num_rows * (size_t) stride; i++) {
+        data[i] = (unsigned char) (i * 7 + seed);
+    }
+
+    cairo_surface_mark_dirty (surface);
+}
+
+// Uploads `surface` to `key_id` and checks that exactly `expected_reports` data reports went out
+// before the commit, and that the keypad decoded the same image as a full upload would give
+static void check_partial_upload (infdevice_t     *device,
+                                  infkey_t         key_id,
+                                  cairo_surface_t *surface,
+                                  unsigned int     expected_reports,
+                                  const char      *what)
+{
+    infpixmap_t *pixmap = infpixmap_create ();
+    infpixmap_update_with_surface (pixmap, surface);
+
+    const unsigned long before = infmock_get_report_count (device);
+    infdevice_set_pixmap_for_key_id (device, key_id, pixmap);
+    const unsigned long sent = infmock_get_report_count (device) - before;
+
+    infmock_report_t reports[NUM_CHUNKS + 1];
+    const size_t num_reports = infmock_get_reports (device, reports, (sent <= NUM_CHUNKS + 1) ? sent : 0);
+
+    unsigned int data_reports = 0;
+    bool committed = false;
+    for (size_t i = 0; i < num_reports; i++) {
+        data_reports += !reports[i].feature;
+        committed = reports[i].feature;
+    }
+
+    size_t image_size = 0;
+    const unsigned char *expected = infpixmap_get_image_data (pixmap, &image_size);
+    static unsigned char decoded[ICON_WIDTH * ICON_HEIGHT * 3];
+    const bool shown = infmock_get_framebuffer (device, key_id, decoded);
+
+    if (sent != expected_reports + 1 || data_reports != expected_reports || !committed ||
+        !shown || memcmp (decoded, expected, image_size) != 0) {
+        fprintf (stderr, "Partial upload check failed: %s (%lu reports sent)\n", what, sent);
+        exit (1);
+    }
+
+    infpixmap_free (pixmap);
+}
+
+static void bench_partial_upload (const char *name, infdevice_t *device, infcapabilities_t capabilities)
+{
+    infdevice_set_capabilities (device, capabilities);
+
+    cairo_surface_t *surface = infpixmap_create_surface ();
+    fill_surface (surface, 0);
+    infpixmap_t *pixmap = infpixmap_create_wire ();
+
+    // A progress bar along the top of the key: only the first report changes
+    infdevice_stats_t stats;
+    infdevice_reset_stats (device);
+
+    unsigned long frames = 0;
+    const uint64_t start = now_ns ();
+    uint64_t elapsed = 0;
+    for (; elapsed < BENCH_BUDGET_NSEC; frames++) {
+        fill_rows (surface, 0, 8, frames);
+        infpixmap_update_with_surface (pixmap, surface);
+        infdevice_set_pixmap_for_key_id (device, INF_KEY_0, pixmap);
+        elapsed = now_ns () - start;
+    }
+
+    infdevice_get_stats (device, &stats);
+
+    char label[64];
+    snprintf (label, sizeof (label), "%s, %llu B/frame", name,
+              (unsigned long long) (stats.bytes_sent / frames));
+    report (label, frames, elapsed);
+
+    infpixmap_free (pixmap);
+    cairo_surface_destroy (surface);
+}
+
+static void bench_partial (char **argv)
+{
+    infdevice_t *device = open_mock_device ();
+    infdevice_set_pacing (device, INF_PACING_DEADLINE, 0);
+    infdevice_set_capabilities (device, INF_CAPABILITY_PARTIAL_UPLOADS);
+
+    // Upright, the first report holds the first 36 rows and the second one the last 36
+    cairo_surface_t *surface = infpixmap_create_surface ();
+    fill_surface (surface, 0);
+    check_partial_upload (device, INF_KEY_0, surface, NUM_CHUNKS, "first upload");
+
+    fill_rows (surface, 0, 10, 1);
+    check_partial_upload (device, INF_KEY_0, surface, 1, "top rows changed");
+
+    fill_rows (surface, ICON_HEIGHT - 10, 10, 2);
+    check_partial_upload (device, INF_KEY_0, surface, 1, "bottom rows changed");
+
+    // The keypad now holds another key's reports, so both halves have to go again
+    cairo_surface_t *other = infpixmap_create_surface ();
+    fill_surface (other, 3);
+    check_partial_upload (device, INF_KEY_1, other, NUM_CHUNKS, "another key");
+
+    fill_rows (surface, 0, 10, 4);
+    check_partial_upload (device, INF_KEY_0, surface, NUM_CHUNKS, "back to the first key");
+
+    // Same image on a different key: nothing to send but the commit
+    check_partial_upload (device, INF_KEY_2, surface, 0, "same image, another key");
+
+    infdevice_set_capabilities (device, INF_CAPABILITY_NONE);
+    fill_rows (surface, 0, 10, 5);
+    check_partial_upload (device, INF_KEY_0, surface, NUM_CHUNKS, "without the capability");
+
+    cairo_surface_destroy (other);
+    cairo_surface_destroy (surface);
+
+    bench_partial_upload ("progress bar, full", device, INF_CAPABILITY_NONE);
+    bench_partial_upload ("progress bar, partial", device, INF_CAPABILITY_PARTIAL_UPLOADS);
+
+    infdevice_close (device);
+}
+
+// One round of every upload path, alternating between two frames so nothing is skipped
+static void upload_round (infdevice_t *device, infpixmap_t *pixmaps[2], unsigned long round)
+{
+    infpixmap_t *pixmap = pixmaps[round % 2];
+
+    infdevice_set_pixmap_for_key_id (device, INF_KEY_0, pixmap);
+
+    infdevice_submit_pixmap (device, INF_KEY_1, pixmap, NULL, NULL);
+    infdevice_flush (device);
+
+    infdevice_update_t updates[INF_NUM_KEYS];
+    for (unsigned int keynum = 0; keynum < INF_NUM_KEYS; keynum++) {
+        updates[keynum] = (infdevice_update_t) {
+            .key_id = infkey_num_to_key (keynum),
+            .pixmap = pixmap
+        };
+    }
+    infdevice_set_pixmaps (device, updates, INF_NUM_KEYS);
+}
+
+static void bench_alloc_uploads (const char *name, infdevice_t *device, infpixmap_t *(*constructor) ())
+{
+    cairo_surface_t *surface = infpixmap_create_surface ();
+    infpixmap_t *pixmaps[2];
+    for (unsigned int i = 0; i < 2; i++) {
+        fill_surface (surface, i);
+        pixmaps[i] = constructor ();
+        infpixmap_update_with_surface (pixmaps[i], surface);
+    }
+
+    // The first rounds start the writer thread and size the per-key mailboxes
+    for (unsigned long round = 0; round < 4; round++) {
+        upload_round (device, pixmaps, round);
+    }
+
+    const unsigned long before = alloc_count_get ();
+    alloc_count_enable (true);
+
+    unsigned long frames = 0;
+    const uint64_t start = now_ns ();
+    uint64_t elapsed = 0;
+    for (; elapsed < BENCH_BUDGET_NSEC; frames++) {
+        upload_round (device, pixmaps, frames);
+        elapsed = now_ns () - start;
+    }
+
+    alloc_count_enable (false);
+    const unsigned long allocations = alloc_count_get () - before;
+
+    if (allocations != 0) {
+        fprintf (stderr, "%s: %lu allocations over %lu rounds of uploads\n", name, allocations, frames);
+        exit (1);
+    }
+
+    report (name, frames, elapsed);
+
+    infpixmap_free (pixmaps[0]);
+    infpixmap_free (pixmaps[1]);
+    cairo_surface_destroy (surface);
+}
+
+static void bench_alloc (char **argv)
+{
+    infdevice_t *device = open_mock_device ();
+    infdevice_set_pacing (device, INF_PACING_DEADLINE, 0);
+
+    bench_alloc_uploads ("uploads, no allocations (bmp)", device, infpixmap_create);
+    bench_alloc_uploads ("uploads, no allocations (wire)", device, infpixmap_create_wire);
+
+    infdevice_close (device);
+}
+
+int main (int argc, char **argv)
+{
+    if (argc < 2) {
+        print_usage (argv[0]);
+        return 1;
+    }
+
+    unsigned int command_idx = 0;
+    size_t num_commands = sizeof (__commands) / sizeof (command_t);
+    for (; command_idx < num_commands; command_idx++) {
+        const command_t command = __commands[command_idx];
+        if (strcmp (argv[1], command.name) == 0) {
+            command.function (argv + 1);
+            break;
+        }
+    }
+
+    if (command_idx == num_commands) {
+        fprintf (stderr, "Command not found\n");
+        print_usage (argv[0]);
+        return 1;
+    }
+
+    return 0;
+}
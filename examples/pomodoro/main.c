@@ -4,14 +4,16 @@
 #include <pango/pangocairo.h>
 
 #include <fcntl.h>
-#include <semaphore.h>
+#include <poll.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 
 #include <inttypes.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 
 static infdevice_t *g_shared_device;
@@ -22,6 +24,8 @@ static PangoLayout *g_shared_layout;
 static const unsigned int kDefaultTimerLengthSeconds = 25 * 60; // 25 minutes
 static const double kButtonSize = 30.0;
 static const double kDownBorderSize = 15.0;
+static const unsigned int kRepeatDelayMillis = 250;
+static const unsigned int kRepeatIntervalMillis = 100;
 
 typedef enum square_role_t {
     TIMER_MIN = 0,
@@ -49,8 +53,6 @@ typedef enum event_type_t {
     BUTTON_UP,
 } EventType; 
 
-enum { MAX_EVENTS = 8 };
-
 static struct {
     bool       exited;
     bool       running;
@@ -58,13 +60,8 @@ static struct {
     SquareRole dirty_squares[15];
     size_t     num_dirty_squares;
 
-    EventType  events[MAX_EVENTS];
-    size_t     num_events;
-    sem_t      post_event_sem;
-
     SquareRole button_down;
     SquareRole last_button_down;
-    int        last_down_time;
 
     struct {
         unsigned int length;
@@ -76,32 +73,12 @@ static struct {
     } timer;
 } g_app_state;
 
-void push_event (EventType event)
-{
-    g_app_state.events[g_app_state.num_events++] = event;
-    sem_post (&g_app_state.post_event_sem);
-}
-
-EventType pop_event (void)
-{
-    sem_wait (&g_app_state.post_event_sem);
-    return g_app_state.events[--g_app_state.num_events];
-}
-
-void apply_rotation (cairo_t *cr)
-{
-    // Rotate 90 deg
-    cairo_translate (cr, ICON_WIDTH / 2, ICON_HEIGHT / 2);
-    cairo_rotate (cr, M_PI_2);
-    cairo_translate (cr, -ICON_WIDTH / 2, -ICON_HEIGHT / 2);
-}
-
 void update_pixmap_for_role (SquareRole role)
 {
-    infpixmap_update_with_surface (g_shared_pixmap, g_shared_surface);
+    infdevice_update_pixmap_with_surface (g_shared_device, g_shared_pixmap, g_shared_surface);
 
     infkey_t key = infkey_num_to_key (role);
-    infdevice_set_pixmap_for_key_id (g_shared_device, key, g_shared_pixmap);
+    infdevice_submit_pixmap (g_shared_device, key, g_shared_pixmap, NULL, NULL);
 }
 
 void mark_square_dirty (SquareRole square)
@@ -299,7 +276,7 @@ void draw_dirty_squares (cairo_t *cr)
 
 void initialize_drawing (void)
 {
-    g_shared_pixmap = infpixmap_create ();
+    g_shared_pixmap = infpixmap_create_wire ();
     g_shared_surface = infpixmap_create_surface ();
     g_app_state.num_dirty_squares = 0;
 
@@ -351,120 +328,131 @@ void on_tick (void)
     }
 }
 
-int millitime (void)
+void handle_event (EventType event)
 {
-    struct timespec tm;
-    clock_gettime (CLOCK_MONOTONIC, &tm);
+    switch (event) {
+        case TICK: 
+            on_tick (); 
+            break;
 
-    int millis = (tm.tv_sec * 1000);
-    millis += (tm.tv_nsec / 1000000);
+        case PLAY_PAUSE_PRESSED:
+            set_timer_running (!g_app_state.running);
+            if (g_app_state.timer.remaining == 0) {
+                reset_timer ();
+            }
 
-    return millis;
-}
+            break;
 
-void* input_handler (void *args)
-{
-    while (!g_app_state.exited) {
-        infkey_t key = infdevice_read_key (g_shared_device);
+        case STOP_PRESSED:
+            set_timer_running (false);
+            reset_timer ();
+            break;
 
-        SquareRole role = infkey_to_key_num (key);
-        g_app_state.button_down = role;
-        g_app_state.last_down_time = millitime ();
+        case ADD_MINUTE_PRESSED:
+            change_minute_pressed (+1);
+            break;
 
-        if (role == INVALID) {
-            push_event (BUTTON_UP);
-        } else {
-            push_event (BUTTON_DOWN);
-        }
+        case SUB_MINUTE_PRESSED:
+            change_minute_pressed (-1);
+            break;
 
-        switch (role) {
-            case PLAY_PAUSE_BUTTON: push_event (PLAY_PAUSE_PRESSED); break;
-            case STOP_BUTTON: push_event (STOP_PRESSED); break;
-            case ADD_MINUTE: push_event (ADD_MINUTE_PRESSED); break;
-            case SUB_MINUTE: push_event (SUB_MINUTE_PRESSED); break;
+        case BUTTON_UP:
+            if (g_app_state.last_button_down != INVALID) {
+                mark_square_dirty (g_app_state.last_button_down);
+            }
 
-            default: break;
-        }
+            break;
+        case BUTTON_DOWN:
+            g_app_state.last_button_down = g_app_state.button_down;
+            mark_square_dirty (g_app_state.button_down);
+            break;
+
+        default: break;
     }
-    
-    return NULL;
 }
 
-void* tick_handler (void *args)
+void handle_input_event (const infevent_t *event)
 {
-    // TODO: better as a "green thread"?
-    while (!g_app_state.exited) {
-        push_event (TICK);
+    SquareRole role = infkey_to_key_num (event->key_id);
 
-        int now = millitime ();
+    switch (event->type) {
+        case INF_EVENT_PRESS:
+            g_app_state.button_down = role;
+            handle_event (BUTTON_DOWN);
 
-        // Allow add/sub minute buttons to repeat
-        SquareRole down = g_app_state.button_down;
-        int time_diff = (now - g_app_state.last_down_time);
-        if ( (time_diff > 250) && (down == ADD_MINUTE || down == SUB_MINUTE)) {
-            push_event ( (down == ADD_MINUTE) ? ADD_MINUTE_PRESSED : SUB_MINUTE_PRESSED );
-            usleep (100000);
-        } else {
-            sleep (1);
-        }
-    }
+            switch (role) {
+                case PLAY_PAUSE_BUTTON: handle_event (PLAY_PAUSE_PRESSED); break;
+                case STOP_BUTTON: handle_event (STOP_PRESSED); break;
+                case ADD_MINUTE: handle_event (ADD_MINUTE_PRESSED); break;
+                case SUB_MINUTE: handle_event (SUB_MINUTE_PRESSED); break;
+
+                default: break;
+            }
+
+            break;
+
+        case INF_EVENT_RELEASE:
+            if (g_app_state.button_down == role) {
+                g_app_state.button_down = INVALID;
+            }
+            handle_event (BUTTON_UP);
+            break;
 
-    return NULL;
+        case INF_EVENT_REPEAT:
+            // Allow add/sub minute buttons to repeat
+            handle_event ((role == ADD_MINUTE) ? ADD_MINUTE_PRESSED : SUB_MINUTE_PRESSED);
+            break;
+
+        default: break;
+    }
 }
 
 void runloop (void)
 {
     cairo_t *cr = cairo_create (g_shared_surface);
     g_shared_layout = pango_cairo_create_layout (cr);
-    apply_rotation (cr);
 
-    while (!g_app_state.exited) {
-        draw_dirty_squares (cr);
-
-        EventType event = pop_event ();
-
-        // Handle the event
-        switch (event) {
-            case TICK: 
-                on_tick (); 
-                break;
-
-            case PLAY_PAUSE_PRESSED:
-                set_timer_running (!g_app_state.running);
-                if (g_app_state.timer.remaining == 0) {
-                    reset_timer ();
-                }
+    infinput_t *input = infinput_create (g_shared_device);
+    if (!input) {
+        fprintf (stderr, "Could not read input\n");
+        return;
+    }
 
-                break;
+    infkey_t minute_keys = infkey_num_to_key (ADD_MINUTE) | infkey_num_to_key (SUB_MINUTE);
+    infinput_set_repeat (input, minute_keys, kRepeatDelayMillis, kRepeatIntervalMillis);
 
-            case STOP_PRESSED:
-                set_timer_running (false);
-                reset_timer ();
-                break;
+    // Ticks every second
+    int tick_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct itimerspec tick_interval = {
+        .it_interval = { .tv_sec = 1 },
+        .it_value = { .tv_sec = 1 },
+    };
+    timerfd_settime (tick_fd, 0, &tick_interval, NULL);
 
-            case ADD_MINUTE_PRESSED:
-                change_minute_pressed (+1);
-                break;
+    struct pollfd fds[] = {
+        { .fd = infinput_get_fd (input), .events = POLLIN },
+        { .fd = tick_fd,                 .events = POLLIN },
+    };
 
-            case SUB_MINUTE_PRESSED:
-                change_minute_pressed (-1);
-                break;
+    while (!g_app_state.exited) {
+        draw_dirty_squares (cr);
 
-            case BUTTON_UP:
-                if (g_app_state.last_button_down != INVALID) {
-                    mark_square_dirty (g_app_state.last_button_down);
-                }
+        // Sleeps until a key changes, a key repeats or a second passes
+        if (poll (fds, 2, -1) < 0) continue;
 
-                break;
-            case BUTTON_DOWN:
-                g_app_state.last_button_down = g_app_state.button_down;
-                mark_square_dirty (g_app_state.button_down);
-                break;
+        uint64_t expirations = 0;
+        if (read (tick_fd, &expirations, sizeof (expirations)) > 0) {
+            handle_event (TICK);
+        }
 
-            default: break;
+        infevent_t event;
+        while (infinput_next_event (input, 0, &event) > 0) {
+            handle_input_event (&event);
         }
     }
 
+    close (tick_fd);
+    infinput_free (input);
     cairo_destroy (cr);
 }
 
@@ -482,6 +470,9 @@ int main (int argc, char **argv)
         return 1;
     }
 
+    // Squares are drawn upright, the device turns them to match the pad
+    infdevice_set_orientation (g_shared_device, INF_ORIENTATION_90);
+
     g_app_state.timer.length = kDefaultTimerLengthSeconds;
     g_app_state.button_down = INVALID;
     g_app_state.last_button_down = INVALID;
@@ -499,21 +490,12 @@ int main (int argc, char **argv)
 
     initialize_drawing ();
 
-    sem_init (&g_app_state.post_event_sem, 0, 0);
     g_app_state.timer.remaining = g_app_state.timer.length;
     g_app_state.running = false;
 
-    // Create input handler thread
-    pthread_t input_thread, tick_thread;
-    pthread_create (&input_thread, NULL, &input_handler, NULL);
-    pthread_create (&tick_thread, NULL, &tick_handler, NULL);
-
     // Runs until exited = true
     runloop ();
 
-    pthread_join (input_thread, NULL);
-    pthread_join (tick_thread, NULL);
-
     infdevice_close (g_shared_device);
     return 0;
 }
@@ -2,10 +2,9 @@
 
 #include <assert.h>
 #include <cairo/cairo.h>
-#include <math.h>
 #include <X11/Xlib.h>
 #include <X11/Xos.h>
-#include <pthread.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <sys/param.h> // max, min
@@ -25,6 +24,9 @@ typedef struct {
 } application_t;
 
 static application_t __apps_for_keys[INF_NUM_KEYS] = { 0 };
+
+// The whole keypad, one tile per running app in reading order
+static infcanvas_t *__canvas;
 static unsigned int __num_running_apps = 0;
 static bool __running = true;
 
@@ -34,19 +36,6 @@ static Atom __a_client_list;
 static Atom __a_wm_name;
 static Atom __a_wm_icon;
 
-static int
-horiz_key_order (int i)
-{
-    // Converts from a ordinal number to horizontal ordering of keys on the keypad
-    return (i / 3) + ((i % 3) * 5);
-}
-
-static int
-from_horiz_key_order (int i)
-{
-    return (3 * (i % 5)) + ((i / 5) % 3);
-}
-
 static void
 raise_window_id (Window window)
 {
@@ -59,8 +48,6 @@ raise_window_id (Window window)
     event.xclient.format = 32;
 
     XSendEvent (__display, __root_window, False, SubstructureRedirectMask | SubstructureNotifyMask, &event);
-
-    // xxx: X is not multithreaded, so this should be coordinated with the main thread instead.
     XFlush(__display);
 
     XMapRaised (__display, window);
@@ -129,15 +116,6 @@ get_window_property_and_type (Window  window,
     return prop;
 }
 
-void 
-apply_rotation (cairo_t *cr)
-{
-    // Rotate 90 deg
-    cairo_translate (cr, ICON_WIDTH / 2, ICON_HEIGHT / 2);
-    cairo_rotate (cr, M_PI_2);
-    cairo_translate (cr, -ICON_WIDTH / 2, -ICON_HEIGHT / 2);
-}
-
 cairo_surface_t*
 create_surface_for_xicon (unsigned long *icon,
                           size_t         icon_len)
@@ -216,13 +194,15 @@ compute_average_color (cairo_surface_t *pixmap,
 
 static void
 draw_key (application_t *app, 
-          infkey_t       key,
-          infdevice_t   *device)
+          unsigned int   index)
 {
+    cairo_t *cr = cairo_create (infcanvas_get_surface (__canvas));
 
-    cairo_surface_t *pixmap_surface = infpixmap_create_surface ();
-    cairo_t *cr = cairo_create (pixmap_surface);
-    apply_rotation (cr);
+    // Confine drawing to this app's tile
+    const unsigned int columns = infcanvas_get_columns (__canvas);
+    cairo_translate (cr, (index % columns) * ICON_WIDTH, (index / columns) * ICON_HEIGHT);
+    cairo_rectangle (cr, 0, 0, ICON_WIDTH, ICON_HEIGHT);
+    cairo_clip (cr);
 
     cairo_surface_t *icon_surface = app->icon_surface;
 
@@ -251,24 +231,9 @@ draw_key (application_t *app,
         cairo_paint (cr);
     }
 
-    infpixmap_t *pixmap = infpixmap_create ();
-    infpixmap_update_with_surface (pixmap, pixmap_surface);
-    infdevice_set_pixmap_for_key_id (device, key, pixmap);
-
-    infpixmap_free (pixmap);
-    cairo_surface_destroy (pixmap_surface);
     cairo_destroy (cr);
 }
 
-void
-clear_key (infkey_t     key,
-           infdevice_t *device)
-{
-    infpixmap_t *pixmap = infpixmap_create ();
-    infdevice_set_pixmap_for_key_id (device, key, pixmap);
-
-    infpixmap_free (pixmap);
-}
 
 void
 refresh_running_apps ()
@@ -343,18 +308,21 @@ refresh_running_apps ()
 }
 
 static void 
-draw_running_app_icons (infdevice_t *device)
+draw_running_app_icons (void)
 {
-    for (unsigned int i = 0; i < INF_NUM_KEYS; i++) {
-        infkey_t key = infkey_num_to_key (horiz_key_order (i));
+    // Keys without an app are left black
+    cairo_t *cr = cairo_create (infcanvas_get_surface (__canvas));
+    cairo_set_source_rgb (cr, 0.0, 0.0, 0.0);
+    cairo_paint (cr);
+    cairo_destroy (cr);
 
-        if (i < __num_running_apps) {
-            application_t app = __apps_for_keys[i];
-            draw_key (&app, key, device);
-        } else {
-            clear_key (key, device);
-        }
+    for (unsigned int i = 0; i < __num_running_apps; i++) {
+        application_t app = __apps_for_keys[i];
+        draw_key (&app, i);
     }
+
+    // Only keys whose tile changed are sent
+    infcanvas_present (__canvas);
 }
 
 static int
@@ -364,23 +332,17 @@ xlib_error_handler (Display *display, XErrorEvent *e)
     return 0;
 }
 
-static void*
-input_handler_main (void *ctxt)
+static void
+handle_key_press (infkey_t pressed_key)
 {
-    infdevice_t *device = (infdevice_t *)ctxt;
-
-    while (__running) {
-        infkey_t pressed_key = infdevice_read_key (device);
+    unsigned int column, row;
+    if (!infcanvas_get_tile (__canvas, pressed_key, &column, &row)) return; // all keys released
 
-        int keynum = infkey_to_key_num (pressed_key);
-        int app_index = from_horiz_key_order (keynum);
-        if (app_index < __num_running_apps) {
-            application_t pressed_app = __apps_for_keys[app_index];
-            raise_window_id (pressed_app.window);
-        }
+    unsigned int app_index = row * infcanvas_get_columns (__canvas) + column;
+    if (app_index < __num_running_apps) {
+        application_t pressed_app = __apps_for_keys[app_index];
+        raise_window_id (pressed_app.window);
     }
-
-    return NULL;
 }
 
 static void
@@ -406,21 +368,44 @@ handle_x_event (XEvent event)
 static void
 runloop (infdevice_t *device)
 {
-    static pthread_t input_handler_thread = { 0 };
-    pthread_create (&input_handler_thread, NULL, input_handler_main, device);
+    // X and the keypad are both served from this thread
+    struct pollfd fds[] = {
+        { .fd = ConnectionNumber (__display), .events = POLLIN },
+        { .fd = infdevice_get_fd (device),    .events = POLLIN },
+    };
+
+    if (fds[1].fd < 0) {
+        fprintf (stderr, "Unable to read from inf device\n");
+        return;
+    }
 
     XEvent event;
+    bool apps_changed = true;
     while (__running) {
-        refresh_running_apps ();
-        draw_running_app_icons (device);
-        
-        // Assume the next X event we get is a window raise/create/destroy event,
-        // and just continue the loop to refresh the list of apps
-        XNextEvent (__display, &event);
-        handle_x_event (event);
-    }
+        if (apps_changed) {
+            refresh_running_apps ();
+            draw_running_app_icons ();
+            apps_changed = false;
+        }
+
+        // Xlib may already have events queued that poll can't see
+        if (XPending (__display) == 0) {
+            poll (fds, 2, -1);
+        }
+
+        // Assume any X event we get is a window raise/create/destroy event,
+        // and just refresh the list of apps
+        while (XPending (__display) > 0) {
+            XNextEvent (__display, &event);
+            handle_x_event (event);
+            apps_changed = true;
+        }
 
-    pthread_join (input_handler_thread, NULL);
+        infkey_t pressed_key;
+        while (infdevice_try_read_key (device, &pressed_key) > 0) {
+            handle_key_press (pressed_key);
+        }
+    }
 }
 
 int main (int argc, char **argv)
@@ -443,6 +428,11 @@ int main (int argc, char **argv)
         return 1;
     }
 
+    // Keys are drawn upright, the device turns them to match the pad
+    infdevice_set_orientation (device, INF_ORIENTATION_90);
+
+    __canvas = infcanvas_create (device);
+
     // Atoms
     __a_active_window = XInternAtom (__display, "_NET_ACTIVE_WINDOW", False);
     __a_client_list = XInternAtom (__display, "_NET_CLIENT_LIST", True);
@@ -455,6 +445,7 @@ int main (int argc, char **argv)
 
     runloop (device);
 
+    infcanvas_free (__canvas);
     infdevice_close (device);
 
     return 0;
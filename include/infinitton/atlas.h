@@ -0,0 +1,63 @@
+/*
+ * atlas.h
+ *
+ * Icon sets decoded once into a single arena, ready to be uploaded.
+ */
+
+#pragma once
+
+#include "pixmap.h"
+
+#include <stddef.h>
+
+// An atlas holds up to a fixed number of icons, each stored exactly as the reports sent to the
+// device, back to back in one cache-aligned block. Icons are identified by an id, numbered from
+// 0 in the order they were added, or by a name, found through a hash table. Once an icon set is
+// loaded, switching pages is a matter of handing the atlas' pixmaps to `infdevice_set_pixmaps`:
+// nothing is decoded, converted or allocated.
+//
+// Adding icons must not race with anything else on the same atlas; lookups and uploads may run
+// from any number of threads once it is loaded.
+struct infatlas_t_;
+typedef struct infatlas_t_ infatlas_t;
+
+// Longest name an icon can have
+#define INF_ATLAS_MAX_NAME  63
+
+// Creates an empty atlas with room for `capacity` icons
+extern infatlas_t* infatlas_create (size_t capacity);
+
+// Creates an atlas holding every .bmp and .png file in `dir_path`, added in name order and named
+// after the file without its extension. Files that can't be loaded are skipped. Returns NULL if
+// the directory can't be read.
+extern infatlas_t* infatlas_load_directory (const char *dir_path);
+
+// Loads the file at `file_path` as `infpixmap_open_file` would, and adds it under `name`.
+// Returns the new icon's id, or -1 if the file can't be loaded, the atlas is full, or the name
+// is taken or too long.
+extern int infatlas_add_file (infatlas_t *atlas, const char *name, const char *file_path);
+
+// Converts `surface` (a cairo image surface of any size, scaled to fit as for files) turned by
+// `orientation`, and adds it under `name`. Returns the new icon's id, or -1 as for
+// `infatlas_add_file`.
+extern int infatlas_add_surface (infatlas_t       *atlas,
+                                 const char       *name,
+                                 cairo_surface_t  *surface,
+                                 inforientation_t  orientation);
+
+// Returns the id of the icon called `name`, or -1 if there is none
+extern int infatlas_find (infatlas_t *atlas, const char *name);
+
+// Returns the pixmap for icon `id`, or NULL if there is no such icon. The pixmap belongs to the
+// atlas and lives as long as it does; it must not be changed, and `infpixmap_free` does nothing
+// to it.
+extern infpixmap_t* infatlas_get_pixmap (infatlas_t *atlas, int id);
+
+// Returns the name of icon `id`, or NULL if there is no such icon
+extern const char* infatlas_get_name (infatlas_t *atlas, int id);
+
+// Returns how many icons the atlas holds
+extern size_t infatlas_get_count (infatlas_t *atlas);
+
+// Frees the atlas and its pixmaps
+extern void infatlas_free (infatlas_t *atlas);
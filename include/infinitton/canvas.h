@@ -0,0 +1,69 @@
+/*
+ * canvas.h
+ *
+ * The whole keypad as a single surface, sliced into keys by the library.
+ */
+
+#pragma once
+
+#include "device.h"
+#include "keys.h"
+
+#include <stdbool.h>
+#include <cairo/cairo.h>
+
+// A canvas is one cairo surface covering every key, laid out as the pad is seen: five columns of
+// three keys (360x216) when the device's orientation is INF_ORIENTATION_0 or INF_ORIENTATION_180,
+// three columns of five keys (216x360) when it is a quarter turn. Draw anywhere on it, then
+// `infcanvas_present` sends each key its 72x72 tile, turned by that orientation. The canvas keeps
+// a copy of what it last presented, so keys whose tile is unchanged aren't even converted.
+//
+// The layout is fixed when the canvas is created; make a new canvas after changing the device's
+// orientation. A canvas must only be used from one thread at a time, and must be freed before
+// its device is closed.
+struct infcanvas_t_;
+typedef struct infcanvas_t_ infcanvas_t;
+
+// What changed on a canvas since it was last presented. An image is sent in two reports, so each
+// key's tile is also split in two halves: which rows or columns of the tile each half holds
+// depends on the orientation.
+typedef struct {
+    infkey_t keys;         // keys whose tile changed at all
+    infkey_t first_half;   // keys whose first half changed
+    infkey_t second_half;  // keys whose second half changed
+} infcanvas_damage_t;
+
+// Creates a black canvas for `device`, in the layout for its current orientation
+extern infcanvas_t* infcanvas_create (infdevice_t *device);
+
+// Returns the canvas' surface, owned by the canvas
+extern cairo_surface_t* infcanvas_get_surface (infcanvas_t *canvas);
+
+// Returns the number of columns and rows of keys on the canvas
+extern unsigned int infcanvas_get_columns (infcanvas_t *canvas);
+extern unsigned int infcanvas_get_rows (infcanvas_t *canvas);
+
+// Returns the key drawn from the tile at `column`, `row`, counted from the top left, or
+// INF_KEY_CLEARED if there is no such tile
+extern infkey_t infcanvas_get_key (infcanvas_t *canvas, unsigned int column, unsigned int row);
+
+// Finds the tile `key` is drawn from. Its top left corner is at (column * ICON_WIDTH,
+// row * ICON_HEIGHT). Returns false if `key` isn't a single key.
+extern bool infcanvas_get_tile (infcanvas_t  *canvas,
+                                infkey_t      key,
+                                unsigned int *out_column,
+                                unsigned int *out_row);
+
+// Compares the canvas with what was last presented and fills in `out_damage`. Keys that were never
+// presented, or whose upload failed, count as entirely changed. Returns `out_damage->keys`.
+extern infkey_t infcanvas_get_damage (infcanvas_t *canvas, infcanvas_damage_t *out_damage);
+
+// Sends each key whose tile changed since it was last presented, in a single pass. Returns the keys
+// that were sent.
+extern infkey_t infcanvas_present (infcanvas_t *canvas);
+
+// Makes `keys` count as changed at the next present, for when something else was drawn on them
+extern void infcanvas_invalidate (infcanvas_t *canvas, infkey_t keys);
+
+// Frees the canvas. Whatever the keys show stays on them.
+extern void infcanvas_free (infcanvas_t *canvas);
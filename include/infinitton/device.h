@@ -9,22 +9,234 @@
 #include "pixmap.h"
 #include "keys.h"
 
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Thread safety: a device handle may be shared between threads. Uploads from any number of threads
+ * are serialized internally, and reads (`infdevice_read_key` and friends, or the descriptor from
+ * `infdevice_get_fd`) use a separate path that never waits for an upload in progress, so one thread
+ * can block on input while another uploads. If several threads read, each key state goes to one
+ * of them. Pacing, stats and `infdevice_is_connected` never block. The exception is
+ * `infdevice_close`, which must not race with any other call on the same device.
+ */
+
 struct infdevice_t_;
 typedef struct infdevice_t_ infdevice_t;
 
+// How reports get to the device, see `infdevice_open_with_backend`
+typedef enum {
+    INF_BACKEND_DEFAULT = 0, // hidapi, unless the INFINITTON_BACKEND environment variable says
+                             // "hidraw" or "mock"
+    INF_BACKEND_HIDAPI,      // hidapi-libusb
+    INF_BACKEND_HIDRAW,      // the kernel's /dev/hidraw* nodes, one syscall per report
+    INF_BACKEND_MOCK,        // an in-memory virtual device, see "mock.h"
+} infbackend_t;
+
+// One keypad found by `infdevice_enumerate`
+typedef struct {
+    char path[256];    // pass to `infdevice_open_path`
+    char serial[128];  // USB serial number, empty if the pad doesn't report one
+} infdevice_info_t;
+
+// How the delay between a key's data reports and its commit is applied, see `infdevice_set_pacing`
+typedef enum {
+    INF_PACING_DEADLINE = 0, // wait only what remains of the delay since the last report was written
+    INF_PACING_FIXED,        // always sleep the full delay
+} infpacing_mode_t;
+
+// Optional keypad behaviors the library may rely on, see `infdevice_set_capabilities`
+typedef enum {
+    INF_CAPABILITY_NONE = 0,
+
+    // The keypad keeps the data reports it was sent until they are overwritten, commits included,
+    // and a commit shows whatever they hold. An image is sent in two reports, each half of the
+    // stream; with this set, a report identical to the one the keypad already holds is left out,
+    // so changing only one half of an icon (a progress bar, a label) sends half as much.
+    INF_CAPABILITY_PARTIAL_UPLOADS = (1 << 0),
+} infcapabilities_t;
+
+// One entry of a batched update, see `infdevice_set_pixmaps`
+typedef struct {
+    infkey_t     key_id;
+    infpixmap_t *pixmap;
+} infdevice_update_t;
+
+// Passed to an upload's completion callback
+typedef enum {
+    INF_UPLOAD_COMPLETED = 0,
+    INF_UPLOAD_FAILED,
+    INF_UPLOAD_SUPERSEDED, // replaced by a newer frame for the same key before it was sent
+} infupload_result_t;
+
+// Called on the device's writer thread once a submitted upload has finished. For
+// INF_UPLOAD_SUPERSEDED it is called on the thread that submitted the newer frame instead.
+typedef void (*infdevice_upload_callback_t) (infdevice_t        *device,
+                                             infkey_t            key_id,
+                                             infupload_result_t  result,
+                                             void               *user_data);
+
+// Number of buckets in an `infstats_histogram_t`
+#define INF_STATS_HISTOGRAM_BUCKETS  32
+
+// Log-scale histogram of durations: bucket i counts samples that took [2^i, 2^(i+1)) nanoseconds,
+// and the last bucket also holds everything longer.
+typedef struct {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[INF_STATS_HISTOGRAM_BUCKETS];
+} infstats_histogram_t;
+
+// Counters collected since the device was opened, see `infdevice_get_stats`
+typedef struct {
+    infstats_histogram_t encode;     // packing a frame into data reports (not needed for wire pixmaps)
+    infstats_histogram_t write;      // each data report write
+    infstats_histogram_t pacing;     // time slept before each commit
+    infstats_histogram_t feature;    // each commit (feature report)
+    infstats_histogram_t read_wait;  // each read that returned a key state, including the wait for it
+
+    uint64_t bytes_sent;             // data and feature reports
+    uint64_t failed_writes;
+    uint64_t short_writes;           // reports the transport only partially accepted
+    uint64_t read_timeouts;          // key reads that waited and returned without a key state
+    uint64_t skipped_uploads;        // see `infdevice_get_skipped_uploads`
+    uint64_t skipped_reports;        // data reports left out, see INF_CAPABILITY_PARTIAL_UPLOADS
+    uint64_t disconnects;
+    uint64_t reconnects;
+    uint64_t uploads_per_key[INF_NUM_KEYS];
+} infdevice_stats_t;
+
 // If the device exists, returns a handle to it. Otherwise, returns NULL
 extern infdevice_t* infdevice_open ();
 
-// Close and cleanup the device
+// Same as `infdevice_open`, talking to the device through the given backend
+extern infdevice_t* infdevice_open_with_backend (infbackend_t backend);
+
+// Fills in up to `max_devices` entries for the keypads `backend` can see and returns how many
+// there are, which may be more than `max_devices`. Paths are specific to the backend.
+extern size_t infdevice_enumerate (infbackend_t      backend,
+                                   infdevice_info_t *out_devices,
+                                   size_t            max_devices);
+
+// Opens the keypad at `path`, as returned by `infdevice_enumerate` for the same backend.
+// A NULL `path` opens the first keypad. Every device has its own handle, locks and writer
+// thread, so several pads can be driven in parallel from different threads.
+extern infdevice_t* infdevice_open_path (infbackend_t backend, const char *path);
+
+// Opens the keypad with the given USB serial number, or returns NULL if none is connected
+extern infdevice_t* infdevice_open_serial (infbackend_t backend, const char *serial);
+
+// Returns the name of the backend in use, e.g. "hidapi" or "hidraw"
+extern const char* infdevice_get_backend_name (infdevice_t *device);
+
+// Whether the keypad is currently reachable. A hidapi or hidraw keypad that is unplugged or
+// re-enumerates is looked for every half second and reopened when it's back (by serial number,
+// or at the same path if it has none), and every key's last frame is sent again as a single
+// paced burst. Uploads made in the meantime fail, but the latest frame for each key is kept for
+// the replay. Reads wait for the keypad to return as if no key was pressed.
+extern bool infdevice_is_connected (infdevice_t *device);
+
+// Close and cleanup the device. Uploads still queued by `infdevice_submit_pixmap` are sent first.
 extern void infdevice_close (infdevice_t *device);
 
 // Sets a pixmap (icon) to a particular key_id, see "keys.h" for what to pass as `key_id`.
+// Nothing is sent if the key is already showing an identical frame.
 extern void infdevice_set_pixmap_for_key_id (infdevice_t *device, 
                                              infkey_t    key_id, 
                                              infpixmap_t *pixmap);
 
+// Updates several keys at once, e.g. for a full-panel refresh. Reports for all keys are sent
+// as one paced sequence, with each key's reports prepared while the previous key's commit delay
+// elapses. If a key appears more than once, its last entry wins. Returns false if any upload failed.
+extern bool infdevice_set_pixmaps (infdevice_t              *device,
+                                   const infdevice_update_t *updates,
+                                   size_t                    num_updates);
+
+// The device needs a short gap between the image data for a key and the report that commits it
+// to the display, or it shows corruption. Defaults to INF_PACING_DEADLINE with 1500us, where any
+// work done after the data was written (such as preparing the next key) counts towards the gap.
+extern void infdevice_set_pacing (infdevice_t      *device,
+                                  infpacing_mode_t  mode,
+                                  unsigned int      commit_delay_usec);
+
+// Sets how drawings are turned for this keypad by `infdevice_update_pixmap_with_surface`, so apps
+// can draw upright whichever way the pad is mounted. Defaults to INF_ORIENTATION_0 (the image as
+// drawn); the examples draw upright on a pad in its usual position with INF_ORIENTATION_90.
+extern void infdevice_set_orientation (infdevice_t *device, inforientation_t orientation);
+
+// Returns the orientation set with `infdevice_set_orientation`
+extern inforientation_t infdevice_get_orientation (infdevice_t *device);
+
+// Tells the library which optional behaviors the keypad has, or'ed together. Defaults to
+// INF_CAPABILITY_NONE, which works with any keypad. Takes effect from the next upload.
+extern void infdevice_set_capabilities (infdevice_t *device, infcapabilities_t capabilities);
+
+// Returns the capabilities set with `infdevice_set_capabilities`
+extern infcapabilities_t infdevice_get_capabilities (infdevice_t *device);
+
+// Updates `pixmap` from `surface` like `infpixmap_update_with_surface`, turned by the device's
+// orientation as part of the conversion.
+extern void infdevice_update_pixmap_with_surface (infdevice_t     *device,
+                                                  infpixmap_t     *pixmap,
+                                                  cairo_surface_t *surface);
+
+// Returns a 72x72 RGB24 cairo surface owned by the device for drawing the given key, the same
+// one on every call. It lives until the device is closed; don't destroy it. Returns NULL for
+// an invalid key.
+extern cairo_surface_t* infdevice_get_key_surface (infdevice_t *device, infkey_t key_id);
+
+// Converts the key's surface from `infdevice_get_key_surface` straight into the device's report
+// buffers, turned by the device's orientation, and uploads it, with no pixmap in between. Like
+// `infdevice_set_pixmap_for_key_id`, nothing is sent if the key already shows that frame. Don't
+// draw into the surface while this runs. Returns false if the upload failed, or if the key's
+// surface was never requested.
+extern bool infdevice_upload_key_surface (infdevice_t *device, infkey_t key_id);
+
+// Forgets what is displayed on `keys` (a bitfield of infkey_t), so the next upload to
+// each of them is sent even if it is identical to the last one.
+extern void infdevice_invalidate_keys (infdevice_t *device, infkey_t keys);
+
+// Returns the number of uploads skipped so far because the key already showed that frame.
+extern unsigned long infdevice_get_skipped_uploads (infdevice_t *device);
+
+// Copies the device's counters and latency histograms into `out_stats`. Collection is always on;
+// recording is a handful of relaxed atomic adds per report and never takes a lock.
+extern void infdevice_get_stats (infdevice_t *device, infdevice_stats_t *out_stats);
+
+// Zeroes every counter returned by `infdevice_get_stats`
+extern void infdevice_reset_stats (infdevice_t *device);
+
+// Asynchronous version of `infdevice_set_pixmap_for_key_id`. The pixmap's contents are copied
+// and queued for the device's writer thread, so this returns immediately and `pixmap` may be
+// reused or freed right away. `callback` is optional. Returns false if the upload couldn't be queued.
+//
+// Each key holds at most one pending frame: submitting again before the previous frame for the
+// same key went out replaces it, so the panel always converges on the latest frame.
+extern bool infdevice_submit_pixmap (infdevice_t                *device,
+                                     infkey_t                    key_id,
+                                     infpixmap_t                *pixmap,
+                                     infdevice_upload_callback_t callback,
+                                     void                       *user_data);
+
+// Blocks until every upload submitted before this call has been sent to the device.
+extern void infdevice_flush (infdevice_t *device);
+
 // Returns a bitfield (defined in keys.h as infkey_t) representing which keys are currently
 // being held down. A result of zero (INF_KEY_CLEARED) is sent for when all keys are released.
 // Blocks the calling thread until a response is read from the device (until a key is pressed).
 extern infkey_t infdevice_read_key (infdevice_t *device);
 
+// Like `infdevice_read_key`, but waits at most `timeout_ms` milliseconds (-1 waits forever).
+// Returns 1 and stores the key state in `out_key` if one was read, 0 on timeout, -1 on error.
+extern int infdevice_read_key_timeout (infdevice_t *device, int timeout_ms, infkey_t *out_key);
+
+// Non-blocking version of `infdevice_read_key`, with the same results as `infdevice_read_key_timeout`.
+extern int infdevice_try_read_key (infdevice_t *device, infkey_t *out_key);
+
+// Returns a file descriptor that becomes readable when a key state is waiting, for use with
+// poll/epoll alongside other event sources. Read key states with `infdevice_try_read_key`, not
+// from the descriptor itself. The descriptor belongs to the device and is closed with it, and it
+// stays the same across reconnects. Returns -1 on failure.
+extern int infdevice_get_fd (infdevice_t *device);
+
@@ -8,5 +8,9 @@
 
 #include <infinitton/keys.h>
 #include <infinitton/device.h>
+#include <infinitton/input.h>
 #include <infinitton/pixmap.h>
+#include <infinitton/atlas.h>
+#include <infinitton/canvas.h>
+#include <infinitton/mock.h>
 
@@ -0,0 +1,62 @@
+/*
+ * input.h
+ *
+ * Turns the raw key states read from a device into per-key events: presses and releases
+ * with timestamps, plus long-press and auto-repeat driven by a timer, so an application
+ * only wakes up when something actually happens.
+ */
+
+#pragma once
+
+#include "device.h"
+#include "keys.h"
+
+#include <stdint.h>
+
+struct infinput_t_;
+typedef struct infinput_t_ infinput_t;
+
+typedef enum {
+    INF_EVENT_PRESS = 0,
+    INF_EVENT_RELEASE,
+    INF_EVENT_LONG_PRESS, // the key has been held for its long-press delay, sent once per hold
+    INF_EVENT_REPEAT,     // sent every repeat interval while the key is held, after the repeat delay
+} infevent_type_t;
+
+typedef struct {
+    infevent_type_t type;
+    infkey_t        key_id;
+    uint64_t        timestamp_ns;  // CLOCK_MONOTONIC. When the state was read for presses and
+                                   // releases, and when the timer was due for the others.
+    unsigned int    repeat_count;  // 1 for the first INF_EVENT_REPEAT of a hold, and so on
+} infevent_t;
+
+// Starts turning the input of `device` into events. The device's key states should then only be
+// read through the returned handle, which belongs to a single thread. Uploads to the device from
+// other threads are fine. Returns NULL on failure.
+extern infinput_t* infinput_create (infdevice_t *device);
+
+extern void infinput_free (infinput_t *input);
+
+// Sends INF_EVENT_LONG_PRESS once any of `keys` (a bitfield of infkey_t) has been held for
+// `delay_msec`. 0 disables it, which is the default. Applies from the next press.
+extern void infinput_set_long_press (infinput_t *input, infkey_t keys, unsigned int delay_msec);
+
+// Sends INF_EVENT_REPEAT for any of `keys` held longer than `delay_msec`, then every
+// `interval_msec`. An interval of 0 disables repeat, which is the default. Applies from the next press.
+extern void infinput_set_repeat (infinput_t  *input,
+                                 infkey_t     keys,
+                                 unsigned int delay_msec,
+                                 unsigned int interval_msec);
+
+// Returns a file descriptor that becomes readable when an event may be waiting, for use with
+// poll/epoll alongside other event sources. Collect events with `infinput_next_event` and a
+// timeout of 0 until it returns 0. The descriptor belongs to `input` and is closed with it.
+extern int infinput_get_fd (infinput_t *input);
+
+// Waits at most `timeout_ms` milliseconds (-1 waits forever) for the next event.
+// Returns 1 and fills in `out_event` if there was one, 0 on timeout, -1 on error.
+extern int infinput_next_event (infinput_t *input, int timeout_ms, infevent_t *out_event);
+
+// Returns the keys currently held down, as of the last event
+extern infkey_t infinput_get_key_state (infinput_t *input);
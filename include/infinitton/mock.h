@@ -0,0 +1,45 @@
+/*
+ * mock.h
+ *
+ * A virtual keypad for running without hardware. Open one with
+ * `infdevice_open_with_backend (INF_BACKEND_MOCK)`; it decodes every report the library
+ * sends into per-key framebuffers and lets key presses be injected.
+ */
+
+#pragma once
+
+#include "device.h"
+
+#include <stdint.h>
+
+// Number of most recent reports kept by a mock device, see `infmock_get_reports`
+#define INF_MOCK_REPORT_LOG_SIZE 1024
+
+typedef struct {
+    uint64_t timestamp_ns;  // CLOCK_MONOTONIC time the report was received
+    uint8_t  report_id;     // 0x02 for image data, 0x12 for a commit
+    size_t   length;
+    bool     feature;       // sent as a feature report
+} infmock_report_t;
+
+// Returns true if `device` was opened with INF_BACKEND_MOCK. The other functions
+// here do nothing for real devices.
+extern bool infmock_is_mock (infdevice_t *device);
+
+// Copies the image last committed to `key_id` into `out_image`, which must hold
+// ICON_WIDTH * ICON_HEIGHT * 3 bytes, in the same layout as `infpixmap_get_image_data`.
+// Returns false if nothing was committed to that key yet.
+extern bool infmock_get_framebuffer (infdevice_t *device, infkey_t key_id, unsigned char *out_image);
+
+// Returns how many times an image was committed to `key_id`
+extern unsigned long infmock_get_commit_count (infdevice_t *device, infkey_t key_id);
+
+// Copies up to `max_reports` of the most recent reports, oldest first, into `out_reports`
+// and returns how many were copied.
+extern size_t infmock_get_reports (infdevice_t *device, infmock_report_t *out_reports, size_t max_reports);
+
+// Returns the total number of reports received, including those dropped from the log
+extern unsigned long infmock_get_report_count (infdevice_t *device);
+
+// Queues a key state, as if the keypad had sent it. It is returned by the next key read.
+extern void infmock_inject_key (infdevice_t *device, infkey_t key_state);
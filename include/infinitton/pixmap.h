@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <cairo/cairo.h>
 
@@ -15,11 +16,33 @@
 struct infpixmap_t_;
 typedef struct infpixmap_t_ infpixmap_t;
 
+struct infpixmap_pool_t_;
+typedef struct infpixmap_pool_t_ infpixmap_pool_t;
+
+// How a drawing is turned on its way to the key, see `infpixmap_update_with_surface_oriented`
+typedef enum {
+    INF_ORIENTATION_0 = 0,
+    INF_ORIENTATION_90,       // a quarter turn clockwise
+    INF_ORIENTATION_180,
+    INF_ORIENTATION_270,
+
+    INF_ORIENTATION_MIRRORED = 1 << 2, // or'ed with one of the above, flips the drawing
+                                       // left to right before it is turned
+} inforientation_t;
+
 // Creates an empty infpixmap_t. 
 extern infpixmap_t* infpixmap_create ();
 
-// Creates a pixmap by loading a pixmap from a BMP file path
-// The BMP file should be 72x72, 24-bits (R8 G8 B8), no colorspace info
+// Creates an empty infpixmap_t whose buffer is laid out exactly as the reports sent to the
+// device, so uploading it involves no further copying. Its contents can only be changed with
+// `infpixmap_update_with_surface`; `infpixmap_get_data` and `infpixmap_get_image_data`
+// return NULL for it.
+extern infpixmap_t* infpixmap_create_wire ();
+
+// Creates a pixmap by loading a BMP or PNG file. BMP files may use any bit depth, palette,
+// bit field layout or row order, but not compression. Images that aren't 72x72 are scaled to
+// fit and centered on black; transparent pixels show black. Returns NULL if the file can't
+// be read or decoded.
 extern infpixmap_t* infpixmap_open_file (const char *file_path);
 
 // Get the raw data pointer, including the bmp header
@@ -28,9 +51,27 @@ extern unsigned char* infpixmap_get_data (infpixmap_t *pixmap, size_t *out_lengt
 // Returns a pointer to just the image data, stored as RGB, 24-bit quantities
 extern unsigned char* infpixmap_get_image_data (infpixmap_t *pixmap, size_t *out_length);
 
-// Free/cleanup pixmap
+// Free/cleanup pixmap. Pixmaps from a pool are returned to it instead.
 extern void infpixmap_free (infpixmap_t *pixmap);
 
+// Makes the pixmap's image black
+extern void infpixmap_clear (infpixmap_t *pixmap);
+
+/* Pools */
+
+// Creates a pool of recycled pixmaps, in wire layout if `wire` is set. Buffers are allocated
+// `capacity` at a time, cache-line aligned, with their headers written once, so once a redraw
+// loop has taken as many pixmaps as it ever holds at once, getting one is a pointer pop and
+// freeing it a push. A pool and its pixmaps must only be used from one thread at a time.
+extern infpixmap_pool_t* infpixmap_pool_create (size_t capacity, bool wire);
+
+// Takes a pixmap from the pool, growing it if none is free. Its image holds whatever its last
+// user left; overwrite it or call `infpixmap_clear`. Give it back with `infpixmap_free`.
+extern infpixmap_t* infpixmap_pool_get (infpixmap_pool_t *pool);
+
+// Frees the pool. Every pixmap taken from it must have been given back.
+extern void infpixmap_pool_free (infpixmap_pool_t *pool);
+
 /* Cairo Extensions */
 
 // Convenience: Returns a properly configured cairo surface for drawing
@@ -40,3 +81,10 @@ extern cairo_surface_t* infpixmap_create_surface ();
 extern void infpixmap_update_with_surface (infpixmap_t     *pixmap, 
                                            cairo_surface_t *surface);
 
+// Same as `infpixmap_update_with_surface`, turning the image as it is converted. The keypad's
+// keys are mounted a quarter turn off, so drawing upright and passing INF_ORIENTATION_90 is the
+// same as rotating the cairo context before drawing, but costs nothing extra.
+extern void infpixmap_update_with_surface_oriented (infpixmap_t      *pixmap,
+                                                    cairo_surface_t  *surface,
+                                                    inforientation_t  orientation);
+
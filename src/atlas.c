@@ -0,0 +1,281 @@
+/*
+ * atlas.c
+ *
+ * Icon sets packed into one arena of ready-to-send frames, see atlas.h
+ */
+
+#include <infinitton/atlas.h>
+
+#include "icon.h"
+#include "wire.h"
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Marks an unused slot in the name table
+#define NO_ICON  (-1)
+
+typedef struct {
+    char name[INF_ATLAS_MAX_NAME + 1];
+} atlas_entry_t;
+
+struct infatlas_t_ {
+    size_t           capacity;
+    size_t           count;
+
+    // The arena, one frame per icon, and the pixmaps that look onto it
+    frame_reports_t *frames;
+    infpixmap_t     *views;
+
+    atlas_entry_t   *entries;
+
+    // Open addressing with linear probing. Kept at most half full, so lookups stay short.
+    int32_t         *table;
+    size_t           table_mask;
+};
+
+// FNV-1a
+static uint32_t hash_name (const char *name)
+{
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *c = (const unsigned char *) name; *c != '\0'; c++) {
+        hash = (hash ^ *c) * 16777619u;
+    }
+
+    return hash;
+}
+
+// Returns the table slot holding `name`, or the empty slot where it would go
+static size_t find_slot (const infatlas_t *atlas, const char *name)
+{
+    size_t slot = hash_name (name) & atlas->table_mask;
+    while (atlas->table[slot] != NO_ICON) {
+        if (strcmp (atlas->entries[atlas->table[slot]].name, name) == 0) {
+            break;
+        }
+
+        slot = (slot + 1) & atlas->table_mask;
+    }
+
+    return slot;
+}
+
+infatlas_t* infatlas_create (size_t capacity)
+{
+    if (capacity == 0) {
+        capacity = 1;
+    }
+
+    infatlas_t *atlas = (infatlas_t *) calloc (1, sizeof (infatlas_t));
+    if (atlas == NULL) {
+        return NULL;
+    }
+
+    atlas->capacity = capacity;
+
+    size_t table_size = 2;
+    while (table_size < 2 * capacity) {
+        table_size *= 2;
+    }
+    atlas->table_mask = table_size - 1;
+
+    void *frames = NULL;
+    if (posix_memalign (&frames, 64, capacity * sizeof (frame_reports_t)) != 0) {
+        frames = NULL;
+    }
+    atlas->frames = (frame_reports_t *) frames;
+
+    atlas->entries = (atlas_entry_t *) malloc (capacity * sizeof (atlas_entry_t));
+    atlas->table = (int32_t *) malloc (table_size * sizeof (int32_t));
+    atlas->views = (atlas->frames != NULL) ? wire_create_views (atlas->frames, capacity) : NULL;
+
+    if (atlas->frames == NULL || atlas->entries == NULL || atlas->table == NULL ||
+        atlas->views == NULL) {
+        fprintf (stderr, "Could not allocate an atlas of %zu icons\n", capacity);
+        infatlas_free (atlas);
+        return NULL;
+    }
+
+    // Like wire pixmaps, frames start zeroed, padding included
+    memset (atlas->frames, 0, capacity * sizeof (frame_reports_t));
+
+    for (size_t i = 0; i < table_size; i++) {
+        atlas->table[i] = NO_ICON;
+    }
+
+    return atlas;
+}
+
+int infatlas_add_surface (infatlas_t       *atlas,
+                          const char       *name,
+                          cairo_surface_t  *surface,
+                          inforientation_t  orientation)
+{
+    if (atlas->count == atlas->capacity) {
+        fprintf (stderr, "Atlas is full, can't add \"%s\"\n", name);
+        return -1;
+    }
+
+    if (strlen (name) > INF_ATLAS_MAX_NAME) {
+        fprintf (stderr, "Icon name \"%s\" is too long\n", name);
+        return -1;
+    }
+
+    const size_t slot = find_slot (atlas, name);
+    if (atlas->table[slot] != NO_ICON) {
+        fprintf (stderr, "Atlas already has an icon called \"%s\"\n", name);
+        return -1;
+    }
+
+    cairo_surface_t *icon = icon_fit (surface);
+    if (icon == NULL) {
+        return -1;
+    }
+
+    const int id = (int) atlas->count;
+    wire_encode_surface (&atlas->frames[id], icon, orientation);
+    cairo_surface_destroy (icon);
+
+    strcpy (atlas->entries[id].name, name);
+    atlas->table[slot] = id;
+    atlas->count++;
+
+    return id;
+}
+
+int infatlas_add_file (infatlas_t *atlas, const char *name, const char *file_path)
+{
+    cairo_surface_t *icon = icon_load_file (file_path);
+    if (icon == NULL) {
+        return -1;
+    }
+
+    // Already fitted, so this only converts
+    const int id = infatlas_add_surface (atlas, name, icon, ICON_FILE_ORIENTATION);
+    cairo_surface_destroy (icon);
+
+    return id;
+}
+
+// Returns the length of `file_name` without its extension, or 0 if it isn't an icon file
+static size_t icon_name_length (const char *file_name)
+{
+    const char *dot = strrchr (file_name, '.');
+    if (dot == NULL || dot == file_name) {
+        return 0;
+    }
+
+    if (strcmp (dot, ".bmp") != 0 && strcmp (dot, ".BMP") != 0 &&
+        strcmp (dot, ".png") != 0 && strcmp (dot, ".PNG") != 0) {
+        return 0;
+    }
+
+    return dot - file_name;
+}
+
+static int compare_names (const void *a, const void *b)
+{
+    return strcmp (*(char * const *) a, *(char * const *) b);
+}
+
+infatlas_t* infatlas_load_directory (const char *dir_path)
+{
+    DIR *dir = opendir (dir_path);
+    if (dir == NULL) {
+        fprintf (stderr, "Could not open icon directory %s\n", dir_path);
+        return NULL;
+    }
+
+    // Collect the names first, so the atlas is sized exactly and ids don't depend on the
+    // order the filesystem lists files in
+    char **file_names = NULL;
+    size_t count = 0;
+    size_t allocated = 0;
+
+    struct dirent *ent;
+    while ((ent = readdir (dir)) != NULL) {
+        if (icon_name_length (ent->d_name) == 0) {
+            continue;
+        }
+
+        if (count == allocated) {
+            allocated = (allocated > 0) ? allocated * 2 : 32;
+            char **grown = (char **) realloc (file_names, allocated * sizeof (char *));
+            if (grown == NULL) {
+                break;
+            }
+            file_names = grown;
+        }
+
+        file_names[count] = strdup (ent->d_name);
+        if (file_names[count] != NULL) {
+            count++;
+        }
+    }
+    closedir (dir);
+
+    qsort (file_names, count, sizeof (char *), compare_names);
+
+    infatlas_t *atlas = infatlas_create (count);
+    for (size_t i = 0; i < count; i++) {
+        if (atlas != NULL) {
+            char name[INF_ATLAS_MAX_NAME + 1];
+            const size_t name_length = icon_name_length (file_names[i]);
+            snprintf (name, sizeof (name), "%.*s", (int) name_length, file_names[i]);
+
+            char path[4096];
+            snprintf (path, sizeof (path), "%s/%s", dir_path, file_names[i]);
+
+            if (infatlas_add_file (atlas, name, path) < 0) {
+                fprintf (stderr, "Skipping icon %s\n", path);
+            }
+        }
+
+        free (file_names[i]);
+    }
+    free (file_names);
+
+    return atlas;
+}
+
+int infatlas_find (infatlas_t *atlas, const char *name)
+{
+    return atlas->table[find_slot (atlas, name)];
+}
+
+infpixmap_t* infatlas_get_pixmap (infatlas_t *atlas, int id)
+{
+    if (id < 0 || (size_t) id >= atlas->count) {
+        return NULL;
+    }
+
+    return wire_view_at (atlas->views, id);
+}
+
+const char* infatlas_get_name (infatlas_t *atlas, int id)
+{
+    if (id < 0 || (size_t) id >= atlas->count) {
+        return NULL;
+    }
+
+    return atlas->entries[id].name;
+}
+
+size_t infatlas_get_count (infatlas_t *atlas)
+{
+    return atlas->count;
+}
+
+void infatlas_free (infatlas_t *atlas)
+{
+    if (atlas->views != NULL) {
+        wire_free_views (atlas->views);
+    }
+
+    free (atlas->table);
+    free (atlas->entries);
+    free (atlas->frames);
+    free (atlas);
+}
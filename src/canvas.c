@@ -0,0 +1,285 @@
+/*
+ * canvas.c
+ *
+ * The keypad as one surface, see canvas.h
+ */
+
+#include <infinitton/canvas.h>
+
+#include "convert.h"
+#include "surfaces.h"
+#include "wire.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// How the keys sit on the pad with INF_ORIENTATION_0, in tiles. Key numbers run along the rows
+// from the right; turned a quarter clockwise this is the layout drawn in keys.h.
+#define PAD_COLUMNS  5
+#define PAD_ROWS     3
+
+// Shadow tiles are stored one after the other, each with its rows packed
+#define TILE_STRIDE  (ICON_WIDTH * 4)
+#define TILE_SIZE    (TILE_STRIDE * ICON_HEIGHT)
+
+// The part of a tile that goes into one of the two reports
+typedef struct {
+    unsigned int x;
+    unsigned int y;
+    unsigned int width;
+    unsigned int height;
+} tile_rect_t;
+
+struct infcanvas_t_ {
+    infdevice_t      *device;
+    inforientation_t  orientation;
+
+    unsigned int      columns;
+    unsigned int      rows;
+    cairo_surface_t  *surface;
+
+    // Each key's tile, indexed by key number: a surface sharing the canvas' pixels
+    cairo_surface_t  *tiles[INF_NUM_KEYS];
+    unsigned int      tile_columns[INF_NUM_KEYS];
+    unsigned int      tile_rows[INF_NUM_KEYS];
+
+    // What each key was last presented with, and whether that is known to be on the key
+    unsigned char    *shadow;
+    infkey_t          shadow_valid;
+
+    tile_rect_t          halves[NUM_CHUNKS];
+    convert_equal_func_t pixels_equal;
+};
+
+static int pad_key_num (unsigned int column, unsigned int row)
+{
+    return (PAD_COLUMNS - 1 - column) + row * PAD_COLUMNS;
+}
+
+// Finds where a tile of the canvas lands on the pad: the same mirroring and quarter turns
+// clockwise that are applied to each key's image, applied to the grid of keys
+static void canvas_to_pad (inforientation_t  orientation,
+                           unsigned int      columns,
+                           unsigned int      rows,
+                           unsigned int     *column,
+                           unsigned int     *row)
+{
+    if (orientation & INF_ORIENTATION_MIRRORED) {
+        *column = columns - 1 - *column;
+    }
+
+    const unsigned int turns = orientation & ~INF_ORIENTATION_MIRRORED;
+    for (unsigned int i = 0; i < turns; i++) {
+        const unsigned int turned_column = rows - 1 - *row;
+        *row = *column;
+        *column = turned_column;
+
+        const unsigned int turned_columns = rows;
+        rows = columns;
+        columns = turned_columns;
+    }
+}
+
+// Compares part of a tile with its shadow a row at a time, stopping at the first difference
+static bool rect_equal (const infcanvas_t  *canvas,
+                        int                 keynum,
+                        const tile_rect_t  *rect)
+{
+    const unsigned char *tile = cairo_image_surface_get_data (canvas->tiles[keynum]);
+    const int stride = cairo_image_surface_get_stride (canvas->tiles[keynum]);
+    const unsigned char *shadow = canvas->shadow + keynum * TILE_SIZE;
+
+    for (unsigned int row = rect->y; row < rect->y + rect->height; row++) {
+        const size_t offset = rect->x * 4;
+        if (!canvas->pixels_equal (tile + row * stride + offset, shadow + row * TILE_STRIDE + offset,
+                                   rect->width)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void update_shadow (infcanvas_t *canvas, int keynum)
+{
+    const unsigned char *tile = cairo_image_surface_get_data (canvas->tiles[keynum]);
+    const int stride = cairo_image_surface_get_stride (canvas->tiles[keynum]);
+    unsigned char *shadow = canvas->shadow + keynum * TILE_SIZE;
+
+    for (unsigned int row = 0; row < ICON_HEIGHT; row++) {
+        memcpy (shadow + row * TILE_STRIDE, tile + row * stride, TILE_STRIDE);
+    }
+}
+
+infcanvas_t* infcanvas_create (infdevice_t *device)
+{
+    infcanvas_t *canvas = (infcanvas_t *) calloc (1, sizeof (infcanvas_t));
+    if (canvas == NULL) {
+        return NULL;
+    }
+
+    canvas->device = device;
+    canvas->orientation = infdevice_get_orientation (device);
+
+    // INF_ORIENTATION_90 and INF_ORIENTATION_270 both have the low bit set
+    const bool quarter_turn = (canvas->orientation & INF_ORIENTATION_90);
+    canvas->columns = quarter_turn ? PAD_ROWS : PAD_COLUMNS;
+    canvas->rows = quarter_turn ? PAD_COLUMNS : PAD_ROWS;
+
+    canvas->surface = cairo_image_surface_create (CAIRO_FORMAT_RGB24,
+                                                  canvas->columns * ICON_WIDTH,
+                                                  canvas->rows * ICON_HEIGHT);
+    void *shadow = NULL;
+    if (posix_memalign (&shadow, 64, INF_NUM_KEYS * TILE_SIZE) != 0) {
+        shadow = NULL;
+    }
+
+    if (cairo_surface_status (canvas->surface) != CAIRO_STATUS_SUCCESS || shadow == NULL) {
+        fprintf (stderr, "Could not create canvas surface\n");
+        cairo_surface_destroy (canvas->surface);
+        free (shadow);
+        free (canvas);
+        return NULL;
+    }
+
+    canvas->shadow = (unsigned char *) shadow;
+    canvas->shadow_valid = INF_KEY_CLEARED;
+    canvas->pixels_equal = convert_get_kernel ()->pixels_equal;
+
+    for (unsigned int i = 0; i < NUM_CHUNKS; i++) {
+        tile_rect_t *half = &canvas->halves[i];
+        wire_chunk_source_rect (i, canvas->orientation, &half->x, &half->y, &half->width, &half->height);
+    }
+
+    // Tiles are windows onto the canvas' pixels, so presenting never copies them
+    unsigned char *data = cairo_image_surface_get_data (canvas->surface);
+    const int stride = cairo_image_surface_get_stride (canvas->surface);
+
+    for (unsigned int row = 0; row < canvas->rows; row++) {
+        for (unsigned int column = 0; column < canvas->columns; column++) {
+            unsigned int pad_column = column;
+            unsigned int pad_row = row;
+            canvas_to_pad (canvas->orientation, canvas->columns, canvas->rows, &pad_column, &pad_row);
+
+            const int keynum = pad_key_num (pad_column, pad_row);
+            unsigned char *tile_data = data + row * ICON_HEIGHT * stride + column * ICON_WIDTH * 4;
+
+            canvas->tiles[keynum] = cairo_image_surface_create_for_data (tile_data, CAIRO_FORMAT_RGB24,
+                                                                         ICON_WIDTH, ICON_HEIGHT, stride);
+            canvas->tile_columns[keynum] = column;
+            canvas->tile_rows[keynum] = row;
+        }
+    }
+
+    return canvas;
+}
+
+cairo_surface_t* infcanvas_get_surface (infcanvas_t *canvas)
+{
+    return canvas->surface;
+}
+
+unsigned int infcanvas_get_columns (infcanvas_t *canvas)
+{
+    return canvas->columns;
+}
+
+unsigned int infcanvas_get_rows (infcanvas_t *canvas)
+{
+    return canvas->rows;
+}
+
+infkey_t infcanvas_get_key (infcanvas_t *canvas, unsigned int column, unsigned int row)
+{
+    if (column >= canvas->columns || row >= canvas->rows) {
+        return INF_KEY_CLEARED;
+    }
+
+    canvas_to_pad (canvas->orientation, canvas->columns, canvas->rows, &column, &row);
+    return infkey_num_to_key (pad_key_num (column, row));
+}
+
+bool infcanvas_get_tile (infcanvas_t  *canvas,
+                         infkey_t      key,
+                         unsigned int *out_column,
+                         unsigned int *out_row)
+{
+    const int keynum = infkey_to_key_num (key);
+    if (keynum < 0 || infkey_num_to_key (keynum) != key) {
+        return false;
+    }
+
+    *out_column = canvas->tile_columns[keynum];
+    *out_row = canvas->tile_rows[keynum];
+    return true;
+}
+
+infkey_t infcanvas_get_damage (infcanvas_t *canvas, infcanvas_damage_t *out_damage)
+{
+    // The tiles read the canvas' memory directly
+    cairo_surface_flush (canvas->surface);
+
+    infkey_t damaged_halves[NUM_CHUNKS] = { INF_KEY_CLEARED };
+    for (unsigned int i = 0; i < INF_NUM_KEYS; i++) {
+        const infkey_t key = infkey_num_to_key (i);
+        const bool valid = (canvas->shadow_valid & key);
+
+        for (unsigned int half = 0; half < NUM_CHUNKS; half++) {
+            if (!valid || !rect_equal (canvas, i, &canvas->halves[half])) {
+                damaged_halves[half] |= key;
+            }
+        }
+    }
+
+    out_damage->first_half = damaged_halves[0];
+    out_damage->second_half = damaged_halves[NUM_CHUNKS - 1];
+    out_damage->keys = out_damage->first_half | out_damage->second_half;
+
+    return out_damage->keys;
+}
+
+infkey_t infcanvas_present (infcanvas_t *canvas)
+{
+    infcanvas_damage_t damage;
+    if (infcanvas_get_damage (canvas, &damage) == INF_KEY_CLEARED) {
+        return INF_KEY_CLEARED;
+    }
+
+    cairo_surface_t *tiles[INF_NUM_KEYS] = { NULL };
+    for (unsigned int i = 0; i < INF_NUM_KEYS; i++) {
+        if (damage.keys & infkey_num_to_key (i)) {
+            tiles[i] = canvas->tiles[i];
+        }
+    }
+
+    infkey_t failed = INF_KEY_CLEARED;
+    const infkey_t sent = infdevice_upload_surfaces (canvas->device, tiles, canvas->orientation, &failed);
+
+    // A key whose upload failed shows something unknown, it is sent again next time
+    for (unsigned int i = 0; i < INF_NUM_KEYS; i++) {
+        const infkey_t key = infkey_num_to_key (i);
+        if ((damage.keys & key) && !(failed & key)) {
+            update_shadow (canvas, i);
+        }
+    }
+    canvas->shadow_valid = (canvas->shadow_valid | damage.keys) & ~failed;
+
+    return sent;
+}
+
+void infcanvas_invalidate (infcanvas_t *canvas, infkey_t keys)
+{
+    canvas->shadow_valid &= ~keys;
+}
+
+void infcanvas_free (infcanvas_t *canvas)
+{
+    for (unsigned int i = 0; i < INF_NUM_KEYS; i++) {
+        cairo_surface_destroy (canvas->tiles[i]);
+    }
+
+    cairo_surface_destroy (canvas->surface);
+    free (canvas->shadow);
+    free (canvas);
+}
@@ -0,0 +1,314 @@
+/*
+ * convert.c
+ *
+ * Row conversion kernels, see convert.h
+ */
+
+#include "convert.h"
+
+#include <infinitton/pixmap.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#define HAVE_NEON_KERNEL 1
+#include <arm_neon.h>
+#endif
+
+#define MAX_KERNELS  4
+
+// Cairo stores each pixel as a 32-bit quantity, where the upper 8-bits are unused.
+// For BMP, we need to convert pixels to 24-bit quantities
+static void convert_row_scalar (unsigned char *dst, const unsigned char *src, ptrdiff_t step)
+{
+    for (ptrdiff_t col = 0; col < ICON_WIDTH; col++) {
+        const unsigned char *pixel = src + col * step;
+        *dst++ = pixel[0];
+        *dst++ = pixel[1];
+        *dst++ = pixel[2];
+    }
+}
+
+// Reads the source pixel at `pixel`, wherever it sits in the row or column
+static inline int32_t load_pixel (const unsigned char *pixel)
+{
+    int32_t value;
+    memcpy (&value, pixel, sizeof (value));
+    return value;
+}
+
+// The bits of a pixel that hold its color, the rest is unused in RGB24
+#define PIXEL_COLOR_MASK  0x00ffffff
+
+static bool pixels_equal_scalar (const unsigned char *a, const unsigned char *b, size_t count)
+{
+    uint32_t diff = 0;
+    for (size_t i = 0; i < count; i++) {
+        diff |= (uint32_t) (load_pixel (a + i * 4) ^ load_pixel (b + i * 4));
+    }
+
+    return (diff & PIXEL_COLOR_MASK) == 0;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+// Stores the 12 useful bytes of `packed` as pixels `col` to `col + 3`. 16 byte stores overlap
+// the next group, except for the last one which may be the end of the buffer.
+__attribute__((target("ssse3")))
+static inline void store_group_ssse3 (unsigned char *dst, ptrdiff_t col, __m128i packed)
+{
+    if (col + 4 < ICON_WIDTH) {
+        _mm_storeu_si128 ((__m128i *) (dst + col * 3), packed);
+    } else {
+        unsigned char last[16];
+        _mm_storeu_si128 ((__m128i *) last, packed);
+        memcpy (dst + col * 3, last, 12);
+    }
+}
+
+// Four pixels at a time: one shuffle drops the unused bytes, and puts the pixels back in
+// order when a row is read backwards. Other steps gather the pixels one by one first.
+__attribute__((target("ssse3")))
+static void convert_row_ssse3 (unsigned char *dst, const unsigned char *src, ptrdiff_t step)
+{
+    const __m128i pack = _mm_setr_epi8 (0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14,
+                                        -1, -1, -1, -1);
+    const __m128i reverse_pack = _mm_setr_epi8 (12, 13, 14, 8, 9, 10, 4, 5, 6, 0, 1, 2,
+                                                -1, -1, -1, -1);
+
+    if (step == -4) {
+        for (ptrdiff_t col = 0; col < ICON_WIDTH; col += 4) {
+            // The four pixels end at this one, in memory order
+            const __m128i pixels = _mm_loadu_si128 ((const __m128i *) (src - (col + 3) * 4));
+            store_group_ssse3 (dst, col, _mm_shuffle_epi8 (pixels, reverse_pack));
+        }
+    } else if (step == 4) {
+        for (ptrdiff_t col = 0; col < ICON_WIDTH; col += 4) {
+            const __m128i pixels = _mm_loadu_si128 ((const __m128i *) (src + col * 4));
+            store_group_ssse3 (dst, col, _mm_shuffle_epi8 (pixels, pack));
+        }
+    } else {
+        for (ptrdiff_t col = 0; col < ICON_WIDTH; col += 4) {
+            const __m128i pixels = _mm_setr_epi32 (load_pixel (src + (col + 0) * step),
+                                                   load_pixel (src + (col + 1) * step),
+                                                   load_pixel (src + (col + 2) * step),
+                                                   load_pixel (src + (col + 3) * step));
+            store_group_ssse3 (dst, col, _mm_shuffle_epi8 (pixels, pack));
+        }
+    }
+}
+
+// Differences are or'ed together and tested once at the end, a row is short enough that
+// stopping early inside it wouldn't pay for the extra branches
+__attribute__((target("ssse3")))
+static bool pixels_equal_ssse3 (const unsigned char *a, const unsigned char *b, size_t count)
+{
+    __m128i diff = _mm_setzero_si128 ();
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i pixels_a = _mm_loadu_si128 ((const __m128i *) (a + i * 4));
+        const __m128i pixels_b = _mm_loadu_si128 ((const __m128i *) (b + i * 4));
+        diff = _mm_or_si128 (diff, _mm_xor_si128 (pixels_a, pixels_b));
+    }
+
+    diff = _mm_and_si128 (diff, _mm_set1_epi32 (PIXEL_COLOR_MASK));
+    if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (diff, _mm_setzero_si128 ())) != 0xffff) {
+        return false;
+    }
+
+    return pixels_equal_scalar (a + i * 4, b + i * 4, count - i);
+}
+
+// Stores the 24 useful bytes of `packed` as pixels `col` to `col + 7`, as above
+__attribute__((target("avx2")))
+static inline void store_group_avx2 (unsigned char *dst, ptrdiff_t col, __m256i packed)
+{
+    if (col + 8 < ICON_WIDTH) {
+        _mm256_storeu_si256 ((__m256i *) (dst + col * 3), packed);
+    } else {
+        unsigned char last[32];
+        _mm256_storeu_si256 ((__m256i *) last, packed);
+        memcpy (dst + col * 3, last, 24);
+    }
+}
+
+// Eight pixels at a time: each 128-bit lane is packed as above, then the 24 useful bytes
+// are gathered at the bottom, swapping the lanes when a row is read backwards.
+__attribute__((target("avx2")))
+static void convert_row_avx2 (unsigned char *dst, const unsigned char *src, ptrdiff_t step)
+{
+    const __m256i pack = _mm256_setr_epi8 (0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14,
+                                           -1, -1, -1, -1,
+                                           0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14,
+                                           -1, -1, -1, -1);
+    const __m256i reverse_pack = _mm256_setr_epi8 (12, 13, 14, 8, 9, 10, 4, 5, 6, 0, 1, 2,
+                                                   -1, -1, -1, -1,
+                                                   12, 13, 14, 8, 9, 10, 4, 5, 6, 0, 1, 2,
+                                                   -1, -1, -1, -1);
+    const __m256i join_lanes = _mm256_setr_epi32 (0, 1, 2, 4, 5, 6, 3, 7);
+    const __m256i swap_lanes = _mm256_setr_epi32 (4, 5, 6, 0, 1, 2, 3, 7);
+
+    if (step == -4) {
+        for (ptrdiff_t col = 0; col < ICON_WIDTH; col += 8) {
+            const __m256i pixels = _mm256_loadu_si256 ((const __m256i *) (src - (col + 7) * 4));
+            const __m256i packed = _mm256_shuffle_epi8 (pixels, reverse_pack);
+            store_group_avx2 (dst, col, _mm256_permutevar8x32_epi32 (packed, swap_lanes));
+        }
+    } else if (step == 4) {
+        for (ptrdiff_t col = 0; col < ICON_WIDTH; col += 8) {
+            const __m256i pixels = _mm256_loadu_si256 ((const __m256i *) (src + col * 4));
+            const __m256i packed = _mm256_shuffle_epi8 (pixels, pack);
+            store_group_avx2 (dst, col, _mm256_permutevar8x32_epi32 (packed, join_lanes));
+        }
+    } else {
+        for (ptrdiff_t col = 0; col < ICON_WIDTH; col += 8) {
+            // Scalar loads beat vpgatherdd for eight pixels on most cores
+            const __m256i pixels = _mm256_setr_epi32 (load_pixel (src + (col + 0) * step),
+                                                      load_pixel (src + (col + 1) * step),
+                                                      load_pixel (src + (col + 2) * step),
+                                                      load_pixel (src + (col + 3) * step),
+                                                      load_pixel (src + (col + 4) * step),
+                                                      load_pixel (src + (col + 5) * step),
+                                                      load_pixel (src + (col + 6) * step),
+                                                      load_pixel (src + (col + 7) * step));
+            const __m256i packed = _mm256_shuffle_epi8 (pixels, pack);
+            store_group_avx2 (dst, col, _mm256_permutevar8x32_epi32 (packed, join_lanes));
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static bool pixels_equal_avx2 (const unsigned char *a, const unsigned char *b, size_t count)
+{
+    __m256i diff = _mm256_setzero_si256 ();
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i pixels_a = _mm256_loadu_si256 ((const __m256i *) (a + i * 4));
+        const __m256i pixels_b = _mm256_loadu_si256 ((const __m256i *) (b + i * 4));
+        diff = _mm256_or_si256 (diff, _mm256_xor_si256 (pixels_a, pixels_b));
+    }
+
+    diff = _mm256_and_si256 (diff, _mm256_set1_epi32 (PIXEL_COLOR_MASK));
+    if (!_mm256_testz_si256 (diff, diff)) {
+        return false;
+    }
+
+    return pixels_equal_scalar (a + i * 4, b + i * 4, count - i);
+}
+
+#endif // HAVE_X86_KERNELS
+
+#ifdef HAVE_NEON_KERNEL
+
+// Eight pixels at a time: de-interleaving loads and interleaving stores drop the unused
+// byte, and each channel is reversed on its own when a row is read backwards.
+static void convert_row_neon (unsigned char *dst, const unsigned char *src, ptrdiff_t step)
+{
+    for (ptrdiff_t col = 0; col < ICON_WIDTH; col += 8) {
+        uint8x8x3_t packed;
+        if (step == -4) {
+            const uint8x8x4_t pixels = vld4_u8 (src - (col + 7) * 4);
+            packed.val[0] = vrev64_u8 (pixels.val[0]);
+            packed.val[1] = vrev64_u8 (pixels.val[1]);
+            packed.val[2] = vrev64_u8 (pixels.val[2]);
+        } else {
+            const unsigned char *first = src + col * 4;
+
+            int32_t gathered[8];
+            if (step != 4) {
+                for (ptrdiff_t i = 0; i < 8; i++) {
+                    gathered[i] = load_pixel (src + (col + i) * step);
+                }
+                first = (const unsigned char *) gathered;
+            }
+
+            const uint8x8x4_t pixels = vld4_u8 (first);
+            packed.val[0] = pixels.val[0];
+            packed.val[1] = pixels.val[1];
+            packed.val[2] = pixels.val[2];
+        }
+
+        vst3_u8 (dst + col * 3, packed);
+    }
+}
+
+static bool pixels_equal_neon (const unsigned char *a, const unsigned char *b, size_t count)
+{
+    uint32x4_t diff = vdupq_n_u32 (0);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const uint32x4_t pixels_a = vld1q_u32 ((const uint32_t *) (a + i * 4));
+        const uint32x4_t pixels_b = vld1q_u32 ((const uint32_t *) (b + i * 4));
+        diff = vorrq_u32 (diff, veorq_u32 (pixels_a, pixels_b));
+    }
+
+    diff = vandq_u32 (diff, vdupq_n_u32 (PIXEL_COLOR_MASK));
+    const uint32x2_t folded = vorr_u32 (vget_low_u32 (diff), vget_high_u32 (diff));
+    if ((vget_lane_u32 (folded, 0) | vget_lane_u32 (folded, 1)) != 0) {
+        return false;
+    }
+
+    return pixels_equal_scalar (a + i * 4, b + i * 4, count - i);
+}
+
+#endif // HAVE_NEON_KERNEL
+
+static convert_kernel_t kernels[MAX_KERNELS];
+static unsigned int num_kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void add_kernel (const char           *name,
+                        convert_row_func_t    convert_row,
+                        convert_equal_func_t  pixels_equal)
+{
+    kernels[num_kernels++] = (convert_kernel_t) {
+        .name = name,
+        .convert_row = convert_row,
+        .pixels_equal = pixels_equal
+    };
+}
+
+// Kernels are added slowest first
+static void detect_kernels (void)
+{
+    add_kernel ("scalar", convert_row_scalar, pixels_equal_scalar);
+
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("ssse3")) {
+        add_kernel ("ssse3", convert_row_ssse3, pixels_equal_ssse3);
+    }
+    if (__builtin_cpu_supports ("avx2")) {
+        add_kernel ("avx2", convert_row_avx2, pixels_equal_avx2);
+    }
+#endif
+
+#ifdef HAVE_NEON_KERNEL
+    add_kernel ("neon", convert_row_neon, pixels_equal_neon);
+#endif
+}
+
+const convert_kernel_t* convert_get_kernel (void)
+{
+    pthread_once (&kernels_once, detect_kernels);
+    return &kernels[num_kernels - 1];
+}
+
+const convert_kernel_t* convert_get_kernels (unsigned int *out_count)
+{
+    pthread_once (&kernels_once, detect_kernels);
+
+    *out_count = num_kernels;
+    return kernels;
+}
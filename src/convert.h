@@ -0,0 +1,35 @@
+/*
+ * convert.h
+ *
+ * Kernels converting one row of the device's image, 24-bit BGR, from a cairo RGB24 surface.
+ * The 72 source pixels of a row are read `step` bytes apart starting at `src`, so the same
+ * kernel reads a surface row forwards (4) or backwards (-4) or a column either way (the
+ * surface stride, or minus it), which is how orientations are applied at no extra cost.
+ * `infpixmap_update_with_surface` uses the fastest kernel the CPU supports; all of them
+ * produce identical output.
+ *
+ * Each kernel also compares runs of RGB24 pixels, ignoring their unused byte, which is how
+ * canvases find the keys that changed.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef void (*convert_row_func_t) (unsigned char *dst, const unsigned char *src, ptrdiff_t step);
+
+// Returns whether the `count` pixels at `a` and `b` have the same colors
+typedef bool (*convert_equal_func_t) (const unsigned char *a, const unsigned char *b, size_t count);
+
+typedef struct {
+    const char           *name;
+    convert_row_func_t    convert_row;
+    convert_equal_func_t  pixels_equal;
+} convert_kernel_t;
+
+// Returns the fastest kernel usable on this CPU
+extern const convert_kernel_t* convert_get_kernel (void);
+
+// Returns every kernel usable on this CPU, the portable scalar one first
+extern const convert_kernel_t* convert_get_kernels (unsigned int *out_count);
@@ -7,25 +7,26 @@
 #include <infinitton/infinitton.h>
 #include <infinitton/util.h>
 
-#include <hidapi/hidapi.h>
+#include "stats.h"
+#include "surfaces.h"
+#include "transport.h"
+#include "wire.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
-#define VENDOR_ID   0xFFFF
-#define PRODUCT_ID  0x1F40
-
-typedef struct __attribute__((__packed__)) {
-    int32_t offset;
-    int32_t length; // 0x1f40
-
-    int32_t ctrl1;  // 0x55aaaa55
-    int32_t ctrl2;  // 0x44332211
-} binary_data_partial_t;
-
 typedef struct __attribute__((__packed__)) {
     int8_t  a; // 0x12
     int16_t b; // 0x1
@@ -40,95 +41,435 @@ typedef struct __attribute__((__packed__)) {
     char    padding[13];
 } feature_packet_t;
 
+// SUCKS that this appears to be necessary. Without a gap between the data reports and
+// the feature report, all kinds of corruption happens on the display.
+#define DEFAULT_COMMIT_DELAY_USEC   1500
+
+// Number of report buffers each device keeps around for encoding
+#define REPORT_RING_SIZE    4
+
 typedef struct __attribute__((__packed__)) {
     int8_t  descriptor; // always seems to be 0x01.
     int16_t key_state;  // this is 0x0000 when a key goes up.  
 } inf_input_t;
 
+// How long the input pump blocks in a read before checking whether it should exit
+#define INPUT_PUMP_POLL_MSEC  100
+
+// How often a lost keypad is looked for, and how often waiting readers check whether it's back
+#define RECONNECT_INTERVAL_MSEC   500
+#define DISCONNECTED_POLL_MSEC    100
+
+// A frame to upload: either a plain BMP stream that still has to be encoded into
+// reports, or a wire-layout pixmap buffer that already holds them.
+typedef struct {
+    const unsigned char *data;
+    size_t               length;       // bytes at `data`
+    size_t               stream_size;  // size of the BMP stream, sent with the commit
+    bool                 wire;
+} frame_t;
+
+// Holds the latest not-yet-sent frame for a single key. A newer submission for the
+// same key replaces the frame in place, so at most one upload per key is ever queued.
+typedef struct {
+    bool           pending;
+    uint64_t       sequence;  // submission order, the oldest pending slot is sent first
+
+    unsigned char *data;
+    size_t         size;
+    size_t         capacity;
+    size_t         stream_size;
+    bool           wire;
+
+    infdevice_upload_callback_t callback;
+    void                       *user_data;
+} upload_slot_t;
+
+// Locking: everything on the write path (reports, pacing, the frame caches) is serialized by
+// `write_lock`. The read path never takes it; readers only hold `transport_lock` long enough to
+// grab a reference to the transport. So a key state is never held up behind an in-flight upload,
+// and an upload never waits for a blocked read. Counters are relaxed atomics.
 struct infdevice_t_ {
-    hid_device *hid_device;
+    infbackend_t      backend;
+    const char       *backend_name;
+
+    // The transport is replaced when the keypad reconnects, possibly while a reader is inside
+    // it, so every use takes a reference under `transport_lock`. A replaced transport is closed
+    // once its last user is done with it.
+    pthread_mutex_t   transport_lock;
+    inftransport_t   *transport;         // NULL while disconnected
+    bool              transport_has_fd;  // whether the backend hands out a pollable descriptor
+
+    // hidapi and hidraw keypads are looked for again after they vanish, see `monitor_main`
+    bool              reconnectable;
+    infdevice_info_t  identity;          // which keypad to look for
+    atomic_bool       connected;
+
+    // Held for the duration of a single key upload, so the writer thread and
+    // synchronous callers never interleave reports.
+    pthread_mutex_t write_lock;
+
+    // Preallocated report buffers, handed out round-robin under `write_lock` so that
+    // uploads never allocate and consecutive uploads never share a buffer.
+    frame_reports_t *report_ring;
+    unsigned int     report_ring_next;
+
+    // How the commit delay is applied. Atomic so that changing it never waits for an upload.
+    atomic_int       pacing_mode;
+    atomic_uint      commit_delay_usec;
+
+    atomic_int       orientation;  // see `infdevice_set_orientation`
+    atomic_uint      capabilities; // see `infdevice_set_capabilities`
+
+    struct timespec  last_write_time;  // completion of the most recent data report, protected by `write_lock`
+
+    // Hash of the last frame successfully written to each key, protected by `write_lock`.
+    // Uploads of an identical frame are skipped.
+    uint64_t        key_hashes[INF_NUM_KEYS];
+    bool            key_hash_valid[INF_NUM_KEYS];
+
+    // Hash of the data report the keypad holds at each offset, protected by `write_lock`. Only
+    // kept with INF_CAPABILITY_PARTIAL_UPLOADS, where a report it already holds isn't sent again.
+    uint64_t        staged_hashes[NUM_CHUNKS];
+    bool            staged_valid[NUM_CHUNKS];
+
+    // Last frame handed to each key in wire layout, replayed after a reconnect. Protected by
+    // `write_lock`, and only allocated for reconnectable devices.
+    struct {
+        frame_reports_t *frames;
+        size_t           stream_sizes[INF_NUM_KEYS];
+        uint64_t         hashes[INF_NUM_KEYS];
+        bool             valid[INF_NUM_KEYS];
+    } replay;
+
+    stats_t         stats;
+
+    // Surfaces handed out by `infdevice_get_key_surface`, created on first use under `write_lock`
+    cairo_surface_t *key_surfaces[INF_NUM_KEYS];
+
+    // Writer thread state, all protected by `queue_lock`
+    struct {
+        pthread_mutex_t   queue_lock;
+        pthread_cond_t    queue_cond;  // signaled when a request is queued or on shutdown
+        pthread_cond_t    done_cond;   // signaled when a request completes
+
+        upload_slot_t     slots[INF_NUM_KEYS];
+        unsigned int      num_pending;
+
+        // Frame currently being sent. Swapped with a slot's buffer when taken, so
+        // buffers are reused instead of reallocated.
+        unsigned char    *inflight_data;
+        size_t            inflight_capacity;
+
+        uint64_t          submitted;
+        uint64_t          completed;
+
+        pthread_t         thread;
+        bool              running;
+        bool              exiting;
+    } writer;
+
+    // Some transports (hidapi) have no pollable descriptor, so `infdevice_get_fd` starts a pump
+    // thread that forwards key states into a pipe. Once it runs, all reads are served from the pipe.
+    // Transports with a descriptor are handed out wrapped in an epoll set instead, which keeps
+    // the same number across reconnects.
+    struct {
+        pthread_mutex_t   lock;  // protects starting the pump and the epoll set
+        int               pipe_fds[2];
+        int               epoll_fd;
+        pthread_t         thread;
+        atomic_bool       running;
+        atomic_bool       exiting;
+    } input;
+
+    // Looks for the keypad while it is disconnected, all protected by `lock`
+    struct {
+        pthread_mutex_t   lock;
+        pthread_cond_t    cond;  // signaled when the connection is lost, or on shutdown
+        pthread_t         thread;
+        bool              running;
+        bool              exiting;
+    } monitor;
 };
 
-static void infdevice_write (infdevice_t *device, unsigned char *data, size_t len)
+static void* monitor_main (void *ctxt);
+
+// Returns the current transport with a reference held, or NULL while disconnected
+static inftransport_t* acquire_transport (infdevice_t *device)
 {
-    if (util_debugging_enabled ()) {
-        fwrite (data, len, 1, stdout);
-    } else {
-        hid_write (device->hid_device, data, len);
+    pthread_mutex_lock (&device->transport_lock);
+    inftransport_t *transport = device->transport;
+    if (transport) {
+        transport->refs++;
     }
+    pthread_mutex_unlock (&device->transport_lock);
+
+    return transport;
 }
 
-static void infdevice_feature (infdevice_t *device, unsigned char *data, size_t len)
+static void release_transport (infdevice_t *device, inftransport_t *transport)
 {
-    if (util_debugging_enabled ()) {
-        fwrite (data, len, 1, stdout);
-    } else {
-        hid_send_feature_report (device->hid_device, data, len);
+    pthread_mutex_lock (&device->transport_lock);
+    const bool last = (--transport->refs == 0);
+    pthread_mutex_unlock (&device->transport_lock);
+
+    if (last) {
+        transport->ops->close (transport);
     }
 }
 
-static void transfer_pixmap (infdevice_t *device, infpixmap_t *pixmap)
+static void install_transport (infdevice_t *device, inftransport_t *transport)
 {
-    size_t size = 0;
-    unsigned char *pixmap_data = infpixmap_get_data (pixmap, &size);
-    
-    // Malloc payload and copy data after the header
-    const int8_t report_id = 0x02;
-    const size_t payload_size = 8000; // sent in two chunks
-    const size_t header_size = sizeof (binary_data_partial_t) + 1;
-    const size_t total_chunk_size = payload_size + header_size;
-    
-    size_t offset = 0;
-    unsigned char *payload = (unsigned char *)calloc (total_chunk_size, 1);
-    
-    // Write report_id (0x02)
-    memcpy (payload, &report_id, 1);
-    offset += 1;
-
-    // Write first header
-    binary_data_partial_t header = {
-        .offset = 0,
-        .length = payload_size,
-        .ctrl1  = 0x55aaaa55,
-        .ctrl2  = 0x44332211
-    };
-    memcpy (payload + offset, &header, sizeof (header));
-    offset += sizeof (header);
+    pthread_mutex_lock (&device->transport_lock);
+    transport->refs = 1;
+    device->transport = transport;
+    atomic_store (&device->connected, true);
+    pthread_mutex_unlock (&device->transport_lock);
+}
 
-    // Write first half of image data
-    memcpy (payload + offset, pixmap_data, total_chunk_size - offset);
+// Adds or removes a transport's descriptor from the set returned by `infdevice_get_fd`
+static void watch_transport_fd (infdevice_t *device, inftransport_t *transport, bool watch)
+{
+    pthread_mutex_lock (&device->input.lock);
 
-    // TRANSMIT
-    infdevice_write (device, payload, total_chunk_size);
-    
-    // Second payload
-    memset (payload, 0, total_chunk_size);
+    const int fd = transport->ops->get_fd (transport);
+    if (device->input.epoll_fd >= 0 && fd >= 0) {
+        struct epoll_event event = {
+            .events = EPOLLIN,
+            .data.fd = fd
+        };
+        epoll_ctl (device->input.epoll_fd, watch ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, fd, &event);
+    }
 
-    // report_id
-    memcpy (payload, &report_id, 1);
-    offset = 1;
-    
-    // Second header
-    header.offset = payload_size;
-    header.length = sizeof (header) + size - payload_size;
-    memcpy (payload + offset, &header, sizeof (header));
-    offset += sizeof (header);
+    pthread_mutex_unlock (&device->input.lock);
+}
+
+// Called after `transport` failed a transfer. Drops it, unless it was already replaced, and
+// wakes up the monitor to look for the keypad.
+static void lose_connection (infdevice_t *device, inftransport_t *transport)
+{
+    if (!device->reconnectable) {
+        return;
+    }
+
+    pthread_mutex_lock (&device->transport_lock);
+    const bool current = (device->transport == transport);
+    if (current) {
+        device->transport = NULL;
+        atomic_store (&device->connected, false);
+    }
+    pthread_mutex_unlock (&device->transport_lock);
+
+    if (!current) {
+        return;
+    }
+
+    fprintf (stderr, "Lost connection to keypad, waiting for it to come back\n");
+    stats_add (&device->stats.disconnects, 1);
+
+    watch_transport_fd (device, transport, false);
+    release_transport (device, transport);
+
+    pthread_mutex_lock (&device->monitor.lock);
+    if (!device->monitor.running && !device->monitor.exiting) {
+        if (pthread_create (&device->monitor.thread, NULL, monitor_main, device) == 0) {
+            device->monitor.running = true;
+        } else {
+            fprintf (stderr, "Unable to start reconnect thread\n");
+        }
+    }
+    pthread_cond_signal (&device->monitor.cond);
+    pthread_mutex_unlock (&device->monitor.lock);
+}
 
-    // Second half of image data
-    memcpy (payload + offset, pixmap_data + payload_size, payload_size - offset);
+static void record_transfer (infdevice_t       *device,
+                             stats_histogram_t *histogram,
+                             uint64_t           elapsed_ns,
+                             int                written,
+                             size_t             len)
+{
+    stats_record (histogram, elapsed_ns);
 
-    // TRANSMIT
-    infdevice_write (device, payload, total_chunk_size);
+    if (written < 0) {
+        stats_add (&device->stats.failed_writes, 1);
+        return;
+    }
 
-    // Cleanup
-    free(payload);
+    stats_add (&device->stats.bytes_sent, written);
+    if ((size_t) written < len) {
+        stats_add (&device->stats.short_writes, 1);
+    }
 }
 
-void send_feature (infdevice_t *device, int key_id, infpixmap_t *pixmap)
+static bool infdevice_write (infdevice_t *device, const unsigned char *data, size_t len)
 {
-    size_t size = 0;
-    infpixmap_get_data (pixmap, &size);
+    inftransport_t *transport = acquire_transport (device);
+    if (transport == NULL) {
+        return false;
+    }
+
+    const uint64_t start = stats_now_ns ();
+    int written = transport->ops->write (transport, data, len);
 
+    clock_gettime (CLOCK_MONOTONIC, &device->last_write_time);
+
+    const uint64_t end = (uint64_t) device->last_write_time.tv_sec * 1000000000ULL
+                       + device->last_write_time.tv_nsec;
+    record_transfer (device, &device->stats.write, end - start, written, len);
+
+    if (written < 0) {
+        lose_connection (device, transport);
+    }
+    release_transport (device, transport);
+
+    return (written >= 0);
+}
+
+static bool infdevice_feature (infdevice_t *device, const unsigned char *data, size_t len)
+{
+    inftransport_t *transport = acquire_transport (device);
+    if (transport == NULL) {
+        return false;
+    }
+
+    const uint64_t start = stats_now_ns ();
+    int written = transport->ops->send_feature (transport, data, len);
+
+    record_transfer (device, &device->stats.feature, stats_now_ns () - start, written, len);
+
+    if (written < 0) {
+        lose_connection (device, transport);
+    }
+    release_transport (device, transport);
+
+    return (written >= 0);
+}
+
+static void encode_reports (frame_reports_t     *reports,
+                            const unsigned char *pixmap_data,
+                            size_t               size)
+{
+    wire_write_headers (reports, size);
+
+    for (unsigned int i = 0; i < NUM_CHUNKS; i++) {
+        unsigned char *payload = reports->chunks[i];
+        const size_t offset = CHUNK_HEADER_SIZE;
+
+        // Write this chunk's part of image data. The rest of the chunk stays zeroed.
+        const size_t start = i * CHUNK_PAYLOAD_SIZE;
+        size_t length = (size > start) ? (size - start) : 0;
+        if (length > CHUNK_SIZE - offset) {
+            length = CHUNK_SIZE - offset;
+        }
+        memcpy (payload + offset, pixmap_data + start, length);
+        memset (payload + offset + length, 0, CHUNK_SIZE - offset - length);
+    }
+}
+
+static uint64_t hash_frame (const unsigned char *data, size_t size)
+{
+    // FNV-1a style mixing, a word at a time. Only needs to tell frames apart, not resist attacks.
+    const uint64_t prime = 0x100000001b3ULL;
+    uint64_t hash = 0xcbf29ce484222325ULL ^ size;
+
+    size_t i = 0;
+    for (; i + sizeof (uint64_t) <= size; i += sizeof (uint64_t)) {
+        uint64_t word;
+        memcpy (&word, data + i, sizeof (word));
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 29;
+    }
+
+    for (; i < size; i++) {
+        hash = (hash ^ data[i]) * prime;
+    }
+
+    return hash;
+}
+
+// Forgets what the keypad holds in its data reports. Must be called with `write_lock` held.
+static void invalidate_staged_reports (infdevice_t *device)
+{
+    memset (device->staged_valid, 0, sizeof (device->staged_valid));
+}
+
+// Must be called with `write_lock` held
+static bool send_reports (infdevice_t *device, const frame_reports_t *reports)
+{
+    const bool partial = (atomic_load_explicit (&device->capabilities, memory_order_relaxed)
+                          & INF_CAPABILITY_PARTIAL_UPLOADS);
+
+    bool success = true;
+    for (unsigned int i = 0; i < NUM_CHUNKS; i++) {
+        if (!partial) {
+            // TRANSMIT
+            success &= infdevice_write (device, reports->chunks[i], CHUNK_SIZE);
+            device->staged_valid[i] = false;
+            continue;
+        }
+
+        // Each report's header carries its offset in the stream, so either one can go alone
+        const uint64_t hash = hash_frame (reports->chunks[i], CHUNK_SIZE);
+        if (device->staged_valid[i] && device->staged_hashes[i] == hash) {
+            stats_add (&device->stats.skipped_reports, 1);
+            continue;
+        }
+
+        const bool written = infdevice_write (device, reports->chunks[i], CHUNK_SIZE);
+        device->staged_hashes[i] = hash;
+        device->staged_valid[i] = written;
+        success &= written;
+    }
+
+    return success;
+}
+
+// Must be called with `write_lock` held
+static frame_reports_t* next_reports (infdevice_t *device)
+{
+    frame_reports_t *reports = &device->report_ring[device->report_ring_next];
+    device->report_ring_next = (device->report_ring_next + 1) % REPORT_RING_SIZE;
+
+    return reports;
+}
+
+// Returns reports ready to send for `frame`, encoding them into the ring unless the
+// frame is already in wire layout. Must be called with `write_lock` held.
+static const frame_reports_t* prepare_reports (infdevice_t *device, const frame_t *frame)
+{
+    if (frame->wire) {
+        return (const frame_reports_t *) frame->data;
+    }
+
+    const uint64_t start = stats_now_ns ();
+
+    frame_reports_t *reports = next_reports (device);
+    encode_reports (reports, frame->data, frame->length);
+
+    stats_record (&device->stats.encode, stats_now_ns () - start);
+
+    return reports;
+}
+
+static frame_t frame_for_pixmap (infpixmap_t *pixmap)
+{
+    frame_t frame = { 0 };
+
+    frame_reports_t *reports = infpixmap_get_wire_reports (pixmap, &frame.stream_size);
+    if (reports) {
+        frame.data = (const unsigned char *) reports;
+        frame.length = FRAME_REPORTS_SIZE;
+        frame.wire = true;
+    } else {
+        frame.data = infpixmap_get_data (pixmap, &frame.length);
+        frame.stream_size = frame.length;
+    }
+
+    return frame;
+}
+
+static bool send_feature (infdevice_t *device, int key_id, size_t size)
+{
     feature_packet_t payload = {
         .a = 0x12, // 0x12
         .b = 0x01, // 0x1
@@ -140,32 +481,664 @@ void send_feature (infdevice_t *device, int key_id, infpixmap_t *pixmap)
         .number = size
     };
 
-    infdevice_feature (device, (unsigned char *)&payload, sizeof (feature_packet_t));
+    return infdevice_feature (device, (unsigned char *)&payload, sizeof (feature_packet_t));
+}
+
+
+// Waits out the commit delay before a feature report. Must be called with `write_lock` held.
+static void pace_commit (infdevice_t *device)
+{
+    // Nothing to wait for while the keypad is gone
+    const long delay = atomic_load_explicit (&device->commit_delay_usec, memory_order_relaxed);
+    if (delay == 0 || !atomic_load (&device->connected)) {
+        return;
+    }
+
+    const uint64_t start = stats_now_ns ();
+
+    if (atomic_load_explicit (&device->pacing_mode, memory_order_relaxed) == INF_PACING_FIXED) {
+        usleep (delay);
+    } else {
+        // INF_PACING_DEADLINE: whatever happened since the last report was written already
+        // counts towards the delay
+        const uint64_t last_write = (uint64_t) device->last_write_time.tv_sec * 1000000000ULL
+                                  + device->last_write_time.tv_nsec;
+        const long elapsed = (long) ((start - last_write) / 1000);
+        if (elapsed < delay) {
+            usleep (delay - elapsed);
+        }
+    }
+
+    stats_record (&device->stats.pacing, stats_now_ns () - start);
+}
+
+// Must be called with `write_lock` held
+static bool key_frame_is_current (infdevice_t *device, int keynum, uint64_t hash)
+{
+    return (device->key_hash_valid[keynum] && device->key_hashes[keynum] == hash);
+}
+
+// Must be called with `write_lock` held
+static void remember_key_frame (infdevice_t *device, int keynum, uint64_t hash, bool success)
+{
+    // On failure the key's contents are unknown, so the next upload always goes out
+    device->key_hashes[keynum] = hash;
+    device->key_hash_valid[keynum] = success;
+}
+
+// Keeps a copy of the frame last handed to a key. Must be called with `write_lock` held.
+static void remember_replay_frame (infdevice_t           *device,
+                                   int                    keynum,
+                                   const frame_reports_t *reports,
+                                   size_t                 stream_size,
+                                   uint64_t               hash)
+{
+    if (device->replay.frames == NULL) {
+        return;
+    }
+
+    // Replayed frames are sent straight from here
+    if (reports != &device->replay.frames[keynum]) {
+        memcpy (&device->replay.frames[keynum], reports, FRAME_REPORTS_SIZE);
+    }
+
+    device->replay.stream_sizes[keynum] = stream_size;
+    device->replay.hashes[keynum] = hash;
+    device->replay.valid[keynum] = true;
+}
+
+// Sends prepared reports to a key and commits them. Must be called with `write_lock` held.
+static bool send_key_frame (infdevice_t           *device,
+                            int                    keynum,
+                            const frame_reports_t *reports,
+                            size_t                 stream_size,
+                            uint64_t               hash)
+{
+    remember_replay_frame (device, keynum, reports, stream_size, hash);
+
+    bool success = send_reports (device, reports);
+
+    pace_commit (device);
+
+    success &= send_feature (device, 1 + keynum, stream_size);
+    remember_key_frame (device, keynum, hash, success);
+    stats_add (&device->stats.uploads_per_key[keynum], 1);
+
+    return success;
+}
+
+static bool upload_key (infdevice_t *device, infkey_t key_id, const frame_t *frame)
+{
+    const int keynum = infkey_to_key_num (key_id);
+    const uint64_t hash = hash_frame (frame->data, frame->length);
+
+    pthread_mutex_lock (&device->write_lock);
+
+    if (key_frame_is_current (device, keynum, hash)) {
+        stats_add (&device->stats.skipped_uploads, 1);
+        pthread_mutex_unlock (&device->write_lock);
+        return true;
+    }
+
+    const frame_reports_t *reports = prepare_reports (device, frame);
+    const bool success = send_key_frame (device, keynum, reports, frame->stream_size, hash);
+
+    pthread_mutex_unlock (&device->write_lock);
+
+    return success;
+}
+
+// Sends the frames for the keys in `queue` (both `frames` and `hashes` are indexed by key number)
+// as one paced sequence, with each key's reports prepared while the previous key's commit delay
+// elapses. Must be called with `write_lock` held.
+static bool upload_burst (infdevice_t        *device,
+                          const frame_t      *frames,
+                          const uint64_t     *hashes,
+                          const unsigned int *queue,
+                          unsigned int        queue_len)
+{
+    bool success = true;
+    const frame_reports_t *reports = NULL;
+    if (queue_len > 0) {
+        reports = prepare_reports (device, &frames[queue[0]]);
+    }
+
+    for (unsigned int i = 0; i < queue_len; i++) {
+        const unsigned int keynum = queue[i];
+        remember_replay_frame (device, keynum, reports, frames[keynum].stream_size, hashes[keynum]);
+
+        bool key_success = send_reports (device, reports);
+
+        if (i + 1 < queue_len) {
+            reports = prepare_reports (device, &frames[queue[i + 1]]);
+        }
+
+        pace_commit (device);
+
+        key_success &= send_feature (device, 1 + keynum, frames[keynum].stream_size);
+        remember_key_frame (device, keynum, hashes[keynum], key_success);
+        stats_add (&device->stats.uploads_per_key[keynum], 1);
+
+        success &= key_success;
+    }
+
+    return success;
+}
+
+// Sends every remembered frame again, after a reconnect. Must be called with `write_lock` held.
+static bool replay_key_frames (infdevice_t *device)
+{
+    // A keypad that was unplugged holds nothing
+    invalidate_staged_reports (device);
+
+    frame_t frames[INF_NUM_KEYS];
+    unsigned int queue[INF_NUM_KEYS];
+    unsigned int queue_len = 0;
+    for (unsigned int i = 0; i < INF_NUM_KEYS; i++) {
+        // Whatever the keypad shows now, it isn't what we last sent
+        device->key_hash_valid[i] = false;
+
+        if (device->replay.frames == NULL || !device->replay.valid[i]) continue;
+
+        frames[i] = (frame_t) {
+            .data = (const unsigned char *) &device->replay.frames[i],
+            .length = FRAME_REPORTS_SIZE,
+            .stream_size = device->replay.stream_sizes[i],
+            .wire = true
+        };
+        queue[queue_len++] = i;
+    }
+
+    return upload_burst (device, frames, device->replay.hashes, queue, queue_len);
+}
+
+static void* writer_thread_main (void *ctxt)
+{
+    infdevice_t *device = (infdevice_t *)ctxt;
+
+    pthread_mutex_lock (&device->writer.queue_lock);
+    for (;;) {
+        while (device->writer.num_pending == 0 && !device->writer.exiting) {
+            pthread_cond_wait (&device->writer.queue_cond, &device->writer.queue_lock);
+        }
+
+        // Pending uploads are drained before honoring `exiting`
+        if (device->writer.num_pending == 0) {
+            break;
+        }
+
+        int keynum = -1;
+        for (int i = 0; i < INF_NUM_KEYS; i++) {
+            upload_slot_t *slot = &device->writer.slots[i];
+            if (slot->pending && (keynum < 0 || slot->sequence < device->writer.slots[keynum].sequence)) {
+                keynum = i;
+            }
+        }
+
+        upload_slot_t *slot = &device->writer.slots[keynum];
+        unsigned char *data = slot->data;
+        const size_t size = slot->size;
+        const frame_t frame = {
+            .data = data,
+            .length = size,
+            .stream_size = slot->stream_size,
+            .wire = slot->wire
+        };
+        infdevice_upload_callback_t callback = slot->callback;
+        void *user_data = slot->user_data;
+
+        const size_t slot_capacity = slot->capacity;
+        slot->data = device->writer.inflight_data;
+        slot->capacity = device->writer.inflight_capacity;
+        slot->pending = false;
+        device->writer.inflight_data = data;
+        device->writer.inflight_capacity = slot_capacity;
+        device->writer.num_pending--;
+
+        pthread_mutex_unlock (&device->writer.queue_lock);
+
+        infkey_t key_id = infkey_num_to_key (keynum);
+        bool success = upload_key (device, key_id, &frame);
+        if (callback) {
+            infupload_result_t result = success ? INF_UPLOAD_COMPLETED : INF_UPLOAD_FAILED;
+            callback (device, key_id, result, user_data);
+        }
+
+        pthread_mutex_lock (&device->writer.queue_lock);
+        device->writer.completed++;
+        pthread_cond_broadcast (&device->writer.done_cond);
+    }
+    pthread_mutex_unlock (&device->writer.queue_lock);
+
+    return NULL;
+}
+
+// Milliseconds left of `timeout_ms` since `start_ns`, or -1 for no timeout
+static int remaining_msec (uint64_t start_ns, int timeout_ms)
+{
+    if (timeout_ms < 0) {
+        return -1;
+    }
+
+    const uint64_t elapsed = (stats_now_ns () - start_ns) / 1000000;
+    return (elapsed >= (uint64_t) timeout_ms) ? 0 : timeout_ms - (int) elapsed;
+}
+
+// Reads a single input report straight from the device. While a reconnectable keypad is
+// gone, this waits for it to come back as if no key was pressed.
+// Returns 1 if a key state was read, 0 on timeout and -1 on error.
+static int read_device_input (infdevice_t *device, int timeout_ms, infkey_t *out_key)
+{
+    const uint64_t start = stats_now_ns ();
+
+    for (;;) {
+        const int remaining = remaining_msec (start, timeout_ms);
+
+        inftransport_t *transport = acquire_transport (device);
+        if (transport != NULL) {
+            inf_input_t input_event;
+            int result = transport->ops->read (transport, (unsigned char *)&input_event,
+                                               sizeof (inf_input_t), remaining);
+            if (result < 0) {
+                lose_connection (device, transport);
+            }
+            release_transport (device, transport);
+
+            if (result > 0) {
+                stats_record (&device->stats.read_wait, stats_now_ns () - start);
+
+                *out_key = input_event.key_state;
+                return 1;
+            } else if (result == 0) {
+                return 0;
+            } else if (!device->reconnectable) {
+                return -1;
+            }
+
+            continue;
+        }
+
+        if (remaining == 0) {
+            return 0;
+        }
+
+        const int wait = (remaining < 0 || remaining > DISCONNECTED_POLL_MSEC) ? DISCONNECTED_POLL_MSEC
+                                                                              : remaining;
+        usleep (wait * 1000);
+    }
+}
+
+static void* input_pump_main (void *ctxt)
+{
+    infdevice_t *device = (infdevice_t *)ctxt;
+
+    while (!atomic_load (&device->input.exiting)) {
+        infkey_t key;
+        int result = read_device_input (device, INPUT_PUMP_POLL_MSEC, &key);
+        if (result < 0) {
+            // Readers see end-of-file on the pipe
+            break;
+        } else if (result > 0) {
+            uint16_t state = key;
+            if (write (device->input.pipe_fds[1], &state, sizeof (state)) != sizeof (state)) {
+                fprintf (stderr, "Dropped key event, reader is not keeping up\n");
+            }
+        }
+    }
+
+    close (device->input.pipe_fds[1]);
+    device->input.pipe_fds[1] = -1;
+
+    return NULL;
+}
+
+// Reads the next key state forwarded by the input pump.
+// Returns 1 if a key state was read, 0 on timeout and -1 on error.
+static int read_pumped_input (infdevice_t *device, int timeout_ms, infkey_t *out_key)
+{
+    struct pollfd pfd = {
+        .fd = device->input.pipe_fds[0],
+        .events = POLLIN
+    };
+
+    int ready = poll (&pfd, 1, timeout_ms);
+    if (ready < 0) {
+        return (errno == EINTR) ? 0 : -1;
+    } else if (ready == 0) {
+        return 0;
+    }
+
+    uint16_t state;
+    ssize_t result = read (device->input.pipe_fds[0], &state, sizeof (state));
+    if (result == sizeof (state)) {
+        *out_key = state;
+        return 1;
+    } else if (result < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return 0;
+    }
+
+    return -1;
+}
+
+static infbackend_t default_backend ()
+{
+    const char *name = getenv ("INFINITTON_BACKEND");
+    if (name && strcmp (name, "hidraw") == 0) {
+        return INF_BACKEND_HIDRAW;
+    } else if (name && strcmp (name, "mock") == 0) {
+        return INF_BACKEND_MOCK;
+    }
+
+    return INF_BACKEND_HIDAPI;
 }
 
 infdevice_t* infdevice_open ()
 {
-    hid_device *hid_device = NULL;
-    if (!util_debugging_enabled ()) {
-        hid_device = hid_open (VENDOR_ID, PRODUCT_ID, NULL);
-        if (hid_device == NULL) {
-            fprintf (stderr, "Unable to open device: %s\n", (const char *)hid_error (hid_device));
-            fprintf (stderr, "Check permissions?\n");
-            return NULL;
+    return infdevice_open_with_backend (INF_BACKEND_DEFAULT);
+}
+
+static inftransport_t* open_transport (infbackend_t backend, const char *path)
+{
+    if (backend == INF_BACKEND_MOCK) {
+        return inftransport_mock_open ();
+    } else if (util_debugging_enabled ()) {
+        return inftransport_debug_open ();
+    } else if (backend == INF_BACKEND_HIDRAW) {
+        return inftransport_hidraw_open (path);
+    }
+
+    return inftransport_hidapi_open (path);
+}
+
+infdevice_t* infdevice_open_with_backend (infbackend_t backend)
+{
+    return infdevice_open_path (backend, NULL);
+}
+
+size_t infdevice_enumerate (infbackend_t      backend,
+                            infdevice_info_t *out_devices,
+                            size_t            max_devices)
+{
+    if (backend == INF_BACKEND_DEFAULT) {
+        backend = default_backend ();
+    }
+
+    if (backend == INF_BACKEND_MOCK || util_debugging_enabled ()) {
+        // A single virtual keypad, whatever path it is opened with
+        if (max_devices > 0) {
+            const char *name = (backend == INF_BACKEND_MOCK) ? "mock" : "debug";
+            snprintf (out_devices[0].path, sizeof (out_devices[0].path), "%s", name);
+            out_devices[0].serial[0] = '\0';
+        }
+
+        return 1;
+    } else if (backend == INF_BACKEND_HIDRAW) {
+        return inftransport_hidraw_enumerate (out_devices, max_devices);
+    }
+
+    return inftransport_hidapi_enumerate (out_devices, max_devices);
+}
+
+// Looks a keypad up by serial number if `serial` is given, otherwise by path if `path` is given,
+// otherwise takes the first one
+static bool find_keypad (infbackend_t      backend,
+                         const char       *path,
+                         const char       *serial,
+                         infdevice_info_t *out_info)
+{
+    size_t count = infdevice_enumerate (backend, NULL, 0);
+    if (count == 0) {
+        return false;
+    }
+
+    infdevice_info_t *devices = (infdevice_info_t *) calloc (count, sizeof (infdevice_info_t));
+    if (devices == NULL) {
+        return false;
+    }
+
+    // Pads may have come or gone in between
+    const size_t found = infdevice_enumerate (backend, devices, count);
+    if (found < count) {
+        count = found;
+    }
+
+    bool match = false;
+    for (size_t i = 0; i < count && !match; i++) {
+        if (serial) {
+            match = (strcmp (devices[i].serial, serial) == 0);
+        } else if (path) {
+            match = (strcmp (devices[i].path, path) == 0);
+        } else {
+            match = true;
+        }
+
+        if (match) {
+            *out_info = devices[i];
+        }
+    }
+
+    free (devices);
+
+    return match;
+}
+
+// Reopens the keypad if it's back and replays every key's last frame. Runs on the monitor thread.
+static bool try_reconnect (infdevice_t *device)
+{
+    // Without a serial number, the keypad has to come back at the same path (USB port)
+    const bool by_serial = (device->identity.serial[0] != '\0');
+
+    infdevice_info_t info;
+    if (!find_keypad (device->backend, by_serial ? NULL : device->identity.path,
+                      by_serial ? device->identity.serial : NULL, &info)) {
+        return false;
+    }
+
+    inftransport_t *transport = open_transport (device->backend, info.path);
+    if (transport == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock (&device->write_lock);
+
+    device->identity = info;
+    install_transport (device, transport);
+    watch_transport_fd (device, transport, true);
+
+    fprintf (stderr, "Reconnected to keypad at %s\n", info.path);
+    stats_add (&device->stats.reconnects, 1);
+
+    // One paced burst, the same as a full-panel refresh
+    replay_key_frames (device);
+
+    pthread_mutex_unlock (&device->write_lock);
+
+    return true;
+}
+
+static void* monitor_main (void *ctxt)
+{
+    infdevice_t *device = (infdevice_t *)ctxt;
+
+    pthread_mutex_lock (&device->monitor.lock);
+    while (!device->monitor.exiting) {
+        if (atomic_load (&device->connected)) {
+            pthread_cond_wait (&device->monitor.cond, &device->monitor.lock);
+            continue;
+        }
+
+        struct timespec deadline;
+        clock_gettime (CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += RECONNECT_INTERVAL_MSEC * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        pthread_cond_timedwait (&device->monitor.cond, &device->monitor.lock, &deadline);
+        if (device->monitor.exiting) {
+            break;
+        }
+
+        pthread_mutex_unlock (&device->monitor.lock);
+        try_reconnect (device);
+        pthread_mutex_lock (&device->monitor.lock);
+    }
+    pthread_mutex_unlock (&device->monitor.lock);
+
+    return NULL;
+}
+
+infdevice_t* infdevice_open_serial (infbackend_t backend, const char *serial)
+{
+    infdevice_info_t info;
+    if (!find_keypad (backend, NULL, serial, &info)) {
+        return NULL;
+    }
+
+    return infdevice_open_path (backend, info.path);
+}
+
+infdevice_t* infdevice_open_path (infbackend_t backend, const char *path)
+{
+    if (backend == INF_BACKEND_DEFAULT) {
+        backend = default_backend ();
+    }
+
+    // Remember which keypad this is, so it can be found again if it goes away
+    const bool reconnectable = (backend != INF_BACKEND_MOCK && !util_debugging_enabled ());
+    infdevice_info_t identity;
+    memset (&identity, 0, sizeof (identity));
+    if (reconnectable) {
+        if (find_keypad (backend, path, NULL, &identity)) {
+            path = identity.path;
+        } else if (path) {
+            snprintf (identity.path, sizeof (identity.path), "%s", path);
         }
     }
 
+    inftransport_t *transport = open_transport (backend, path);
+    if (transport == NULL) {
+        return NULL;
+    }
+
+    void *report_ring = NULL;
+    if (posix_memalign (&report_ring, 64, REPORT_RING_SIZE * sizeof (frame_reports_t)) != 0) {
+        fprintf (stderr, "Unable to allocate report buffers\n");
+        transport->ops->close (transport);
+        return NULL;
+    }
+
+    void *replay_frames = NULL;
+    if (reconnectable && posix_memalign (&replay_frames, 64, INF_NUM_KEYS * sizeof (frame_reports_t)) != 0) {
+        fprintf (stderr, "Unable to allocate replay buffers\n");
+        free (report_ring);
+        transport->ops->close (transport);
+        return NULL;
+    }
+
     struct infdevice_t_ *device = (struct infdevice_t_ *) malloc (sizeof (struct infdevice_t_));
-    device->hid_device = hid_device;
+    device->backend = backend;
+    device->backend_name = transport->ops->name;
+    device->transport_has_fd = (transport->ops->get_fd (transport) >= 0);
+    device->reconnectable = reconnectable;
+    device->identity = identity;
+
+    pthread_mutex_init (&device->transport_lock, NULL);
+    install_transport (device, transport);
+
+    pthread_mutex_init (&device->write_lock, NULL);
+    device->report_ring = (frame_reports_t *) report_ring;
+    device->report_ring_next = 0;
+    atomic_init (&device->pacing_mode, INF_PACING_DEADLINE);
+    atomic_init (&device->commit_delay_usec, DEFAULT_COMMIT_DELAY_USEC);
+    atomic_init (&device->orientation, INF_ORIENTATION_0);
+    atomic_init (&device->capabilities, INF_CAPABILITY_NONE);
+    clock_gettime (CLOCK_MONOTONIC, &device->last_write_time);
+    memset (device->key_hash_valid, 0, sizeof (device->key_hash_valid));
+    invalidate_staged_reports (device);
+    memset (device->key_surfaces, 0, sizeof (device->key_surfaces));
+    stats_reset (&device->stats);
+
+    memset (&device->replay, 0, sizeof (device->replay));
+    device->replay.frames = (frame_reports_t *) replay_frames;
+
+    memset (&device->writer, 0, sizeof (device->writer));
+    pthread_mutex_init (&device->writer.queue_lock, NULL);
+    pthread_cond_init (&device->writer.queue_cond, NULL);
+    pthread_cond_init (&device->writer.done_cond, NULL);
+
+    pthread_mutex_init (&device->input.lock, NULL);
+    device->input.pipe_fds[0] = -1;
+    device->input.pipe_fds[1] = -1;
+    device->input.epoll_fd = -1;
+    atomic_init (&device->input.running, false);
+    atomic_init (&device->input.exiting, false);
+
+    memset (&device->monitor, 0, sizeof (device->monitor));
+    pthread_mutex_init (&device->monitor.lock, NULL);
+    pthread_cond_init (&device->monitor.cond, NULL);
 
     return device;
 }
 
 void infdevice_close (infdevice_t *device) 
 {
-    if (device->hid_device) {
-        hid_close (device->hid_device);
+    // Let the writer thread finish anything still queued
+    pthread_mutex_lock (&device->writer.queue_lock);
+    bool running = device->writer.running;
+    device->writer.exiting = true;
+    pthread_cond_signal (&device->writer.queue_cond);
+    pthread_mutex_unlock (&device->writer.queue_lock);
+
+    if (running) {
+        pthread_join (device->writer.thread, NULL);
+    }
+
+    // Stop looking for the keypad, if it was lost
+    pthread_mutex_lock (&device->monitor.lock);
+    running = device->monitor.running;
+    device->monitor.exiting = true;
+    pthread_cond_signal (&device->monitor.cond);
+    pthread_mutex_unlock (&device->monitor.lock);
+
+    if (running) {
+        pthread_join (device->monitor.thread, NULL);
+    }
+
+    if (atomic_load (&device->input.running)) {
+        atomic_store (&device->input.exiting, true);
+        pthread_join (device->input.thread, NULL);
+    }
+
+    if (device->input.pipe_fds[0] >= 0) {
+        close (device->input.pipe_fds[0]);
+    }
+    if (device->input.epoll_fd >= 0) {
+        close (device->input.epoll_fd);
+    }
+    pthread_mutex_destroy (&device->input.lock);
+
+    for (unsigned int i = 0; i < INF_NUM_KEYS; i++) {
+        free (device->writer.slots[i].data);
+
+        if (device->key_surfaces[i]) {
+            cairo_surface_destroy (device->key_surfaces[i]);
+        }
+    }
+    free (device->writer.inflight_data);
+
+    pthread_cond_destroy (&device->monitor.cond);
+    pthread_mutex_destroy (&device->monitor.lock);
+    pthread_cond_destroy (&device->writer.done_cond);
+    pthread_cond_destroy (&device->writer.queue_cond);
+    pthread_mutex_destroy (&device->writer.queue_lock);
+    pthread_mutex_destroy (&device->write_lock);
+    free (device->replay.frames);
+    free (device->report_ring);
+
+    if (device->transport) {
+        release_transport (device, device->transport);
     }
+    pthread_mutex_destroy (&device->transport_lock);
 
     free (device);
 }
@@ -174,20 +1147,427 @@ void infdevice_set_pixmap_for_key_id (infdevice_t *device,
                                       infkey_t    key_id, 
                                       infpixmap_t *pixmap)
 {
-   transfer_pixmap (device, pixmap);
+    const int keynum = infkey_to_key_num (key_id);
+    if (keynum < 0 || keynum >= INF_NUM_KEYS) {
+        return;
+    }
+
+    const frame_t frame = frame_for_pixmap (pixmap);
+    upload_key (device, key_id, &frame);
+}
+
+cairo_surface_t* infdevice_get_key_surface (infdevice_t *device, infkey_t key_id)
+{
+    const int keynum = infkey_to_key_num (key_id);
+    if (keynum < 0 || keynum >= INF_NUM_KEYS) {
+        return NULL;
+    }
 
-   // SUCKS that this appears to be necessary. Without this, all kinds of corruption
-   // happens on the display.
-   usleep (1500);
+    pthread_mutex_lock (&device->write_lock);
+    if (device->key_surfaces[keynum] == NULL) {
+        device->key_surfaces[keynum] = infpixmap_create_surface ();
+    }
+    cairo_surface_t *surface = device->key_surfaces[keynum];
+    pthread_mutex_unlock (&device->write_lock);
 
-   unsigned int keynum = 1 + infkey_to_key_num (key_id);
-   send_feature (device, keynum, pixmap);
+    return surface;
+}
+
+// Converts `surface` straight into the next report buffer, there is no pixmap in between, and
+// sends it unless the key already shows it. Must be called with `write_lock` held.
+static bool upload_surface (infdevice_t      *device,
+                            int               keynum,
+                            cairo_surface_t  *surface,
+                            inforientation_t  orientation,
+                            bool             *out_sent)
+{
+    const uint64_t start = stats_now_ns ();
+
+    frame_reports_t *reports = next_reports (device);
+    const size_t stream_size = wire_encode_surface (reports, surface, orientation);
+
+    stats_record (&device->stats.encode, stats_now_ns () - start);
+
+    const uint64_t hash = hash_frame ((const unsigned char *) reports, FRAME_REPORTS_SIZE);
+    if (key_frame_is_current (device, keynum, hash)) {
+        stats_add (&device->stats.skipped_uploads, 1);
+        *out_sent = false;
+        return true;
+    }
+
+    *out_sent = true;
+    return send_key_frame (device, keynum, reports, stream_size, hash);
+}
+
+bool infdevice_upload_key_surface (infdevice_t *device, infkey_t key_id)
+{
+    const int keynum = infkey_to_key_num (key_id);
+    if (keynum < 0 || keynum >= INF_NUM_KEYS) {
+        return false;
+    }
+
+    pthread_mutex_lock (&device->write_lock);
+
+    bool success = false;
+    cairo_surface_t *surface = device->key_surfaces[keynum];
+    if (surface != NULL) {
+        bool sent;
+        success = upload_surface (device, keynum, surface, infdevice_get_orientation (device), &sent);
+    }
+
+    pthread_mutex_unlock (&device->write_lock);
+
+    return success;
+}
+
+infkey_t infdevice_upload_surfaces (infdevice_t      *device,
+                                    cairo_surface_t  *surfaces[INF_NUM_KEYS],
+                                    inforientation_t  orientation,
+                                    infkey_t         *out_failed)
+{
+    infkey_t sent_keys = INF_KEY_CLEARED;
+    infkey_t failed_keys = INF_KEY_CLEARED;
+
+    pthread_mutex_lock (&device->write_lock);
+
+    for (unsigned int i = 0; i < INF_NUM_KEYS; i++) {
+        if (surfaces[i] == NULL) continue;
+
+        bool sent = false;
+        if (!upload_surface (device, i, surfaces[i], orientation, &sent)) {
+            failed_keys |= infkey_num_to_key (i);
+        }
+        if (sent) {
+            sent_keys |= infkey_num_to_key (i);
+        }
+    }
+
+    pthread_mutex_unlock (&device->write_lock);
+
+    if (out_failed) {
+        *out_failed = failed_keys;
+    }
+
+    return sent_keys;
+}
+
+bool infdevice_set_pixmaps (infdevice_t              *device,
+                             const infdevice_update_t *updates,
+                             size_t                    num_updates)
+{
+    // Last update wins for each key, and keys go out in order
+    infpixmap_t *pixmaps[INF_NUM_KEYS] = { NULL };
+    for (size_t i = 0; i < num_updates; i++) {
+        const int keynum = infkey_to_key_num (updates[i].key_id);
+        if (keynum >= 0 && keynum < INF_NUM_KEYS) {
+            pixmaps[keynum] = updates[i].pixmap;
+        }
+    }
+
+    frame_t frames[INF_NUM_KEYS];
+    uint64_t hashes[INF_NUM_KEYS];
+    for (unsigned int i = 0; i < INF_NUM_KEYS; i++) {
+        if (pixmaps[i]) {
+            frames[i] = frame_for_pixmap (pixmaps[i]);
+            hashes[i] = hash_frame (frames[i].data, frames[i].length);
+        }
+    }
+
+    pthread_mutex_lock (&device->write_lock);
+
+    // Drop keys that already show their frame
+    unsigned int queue[INF_NUM_KEYS];
+    unsigned int queue_len = 0;
+    for (unsigned int i = 0; i < INF_NUM_KEYS; i++) {
+        if (pixmaps[i] == NULL) continue;
+
+        if (key_frame_is_current (device, i, hashes[i])) {
+            stats_add (&device->stats.skipped_uploads, 1);
+        } else {
+            queue[queue_len++] = i;
+        }
+    }
+
+    const bool success = upload_burst (device, frames, hashes, queue, queue_len);
+
+    pthread_mutex_unlock (&device->write_lock);
+
+    return success;
+}
+
+void infdevice_set_pacing (infdevice_t      *device,
+                           infpacing_mode_t  mode,
+                           unsigned int      commit_delay_usec)
+{
+    // Takes effect from the next commit
+    atomic_store (&device->pacing_mode, mode);
+    atomic_store (&device->commit_delay_usec, commit_delay_usec);
+}
+
+void infdevice_set_orientation (infdevice_t *device, inforientation_t orientation)
+{
+    atomic_store_explicit (&device->orientation, orientation, memory_order_relaxed);
+}
+
+inforientation_t infdevice_get_orientation (infdevice_t *device)
+{
+    return (inforientation_t) atomic_load_explicit (&device->orientation, memory_order_relaxed);
+}
+
+void infdevice_set_capabilities (infdevice_t *device, infcapabilities_t capabilities)
+{
+    atomic_store_explicit (&device->capabilities, capabilities, memory_order_relaxed);
+}
+
+infcapabilities_t infdevice_get_capabilities (infdevice_t *device)
+{
+    return (infcapabilities_t) atomic_load_explicit (&device->capabilities, memory_order_relaxed);
+}
+
+void infdevice_update_pixmap_with_surface (infdevice_t     *device,
+                                           infpixmap_t     *pixmap,
+                                           cairo_surface_t *surface)
+{
+    infpixmap_update_with_surface_oriented (pixmap, surface, infdevice_get_orientation (device));
+}
+
+void infdevice_invalidate_keys (infdevice_t *device, infkey_t keys)
+{
+    pthread_mutex_lock (&device->write_lock);
+    for (unsigned int i = 0; i < INF_NUM_KEYS; i++) {
+        if (keys & infkey_num_to_key (i)) {
+            device->key_hash_valid[i] = false;
+        }
+    }
+    pthread_mutex_unlock (&device->write_lock);
+}
+
+unsigned long infdevice_get_skipped_uploads (infdevice_t *device)
+{
+    return atomic_load_explicit (&device->stats.skipped_uploads, memory_order_relaxed);
+}
+
+void infdevice_get_stats (infdevice_t *device, infdevice_stats_t *out_stats)
+{
+    stats_snapshot (&device->stats, out_stats);
+}
+
+void infdevice_reset_stats (infdevice_t *device)
+{
+    stats_reset (&device->stats);
+}
+
+bool infdevice_submit_pixmap (infdevice_t                *device,
+                              infkey_t                    key_id,
+                              infpixmap_t                *pixmap,
+                              infdevice_upload_callback_t callback,
+                              void                       *user_data)
+{
+    const int keynum = infkey_to_key_num (key_id);
+    if (keynum < 0 || keynum >= INF_NUM_KEYS) {
+        return false;
+    }
+
+    const frame_t frame = frame_for_pixmap (pixmap);
+    const size_t size = frame.length;
+
+    pthread_mutex_lock (&device->writer.queue_lock);
+
+    // Writer thread is started lazily, so purely synchronous users never pay for it
+    if (!device->writer.running) {
+        if (pthread_create (&device->writer.thread, NULL, writer_thread_main, device) != 0) {
+            pthread_mutex_unlock (&device->writer.queue_lock);
+            fprintf (stderr, "Unable to start writer thread\n");
+            return false;
+        }
+
+        device->writer.running = true;
+    }
+
+    upload_slot_t *slot = &device->writer.slots[keynum];
+    if (slot->capacity < size) {
+        unsigned char *data = (unsigned char *) realloc (slot->data, size);
+        if (data == NULL) {
+            pthread_mutex_unlock (&device->writer.queue_lock);
+            return false;
+        }
+
+        slot->data = data;
+        slot->capacity = size;
+    }
+
+    // Copy the frame so the caller is free to reuse the pixmap right away
+    memcpy (slot->data, frame.data, size);
+    slot->size = size;
+    slot->stream_size = frame.stream_size;
+    slot->wire = frame.wire;
+
+    const bool superseded = slot->pending;
+    infdevice_upload_callback_t superseded_callback = slot->callback;
+    void *superseded_user_data = slot->user_data;
+
+    slot->callback = callback;
+    slot->user_data = user_data;
+    device->writer.submitted++;
+
+    if (superseded) {
+        // The older frame never goes out, but it still counts towards flush fences.
+        // Its slot keeps its place in line.
+        device->writer.completed++;
+        pthread_cond_broadcast (&device->writer.done_cond);
+    } else {
+        slot->pending = true;
+        slot->sequence = device->writer.submitted;
+        device->writer.num_pending++;
+        pthread_cond_signal (&device->writer.queue_cond);
+    }
+
+    pthread_mutex_unlock (&device->writer.queue_lock);
+
+    if (superseded && superseded_callback) {
+        superseded_callback (device, key_id, INF_UPLOAD_SUPERSEDED, superseded_user_data);
+    }
+
+    return true;
+}
+
+void infdevice_flush (infdevice_t *device)
+{
+    pthread_mutex_lock (&device->writer.queue_lock);
+
+    const uint64_t fence = device->writer.submitted;
+    while (device->writer.completed < fence) {
+        pthread_cond_wait (&device->writer.done_cond, &device->writer.queue_lock);
+    }
+
+    pthread_mutex_unlock (&device->writer.queue_lock);
 }
 
 infkey_t infdevice_read_key (infdevice_t *device)
 {
-    inf_input_t input_event;
-    hid_read (device->hid_device, (unsigned char *)&input_event, sizeof (inf_input_t));
+    infkey_t key = INF_KEY_CLEARED;
+    infdevice_read_key_timeout (device, -1, &key);
+
+    return key;
+}
+
+int infdevice_read_key_timeout (infdevice_t *device, int timeout_ms, infkey_t *out_key)
+{
+    // The input pump only runs for transports without a descriptor of their own, once something
+    // asked for one; key states then have to come from it. Everything else is read directly.
+    int result;
+    if (atomic_load (&device->input.running)) {
+        result = read_pumped_input (device, timeout_ms, out_key);
+    } else {
+        result = read_device_input (device, timeout_ms, out_key);
+    }
+
+    // Only reads that actually waited count. A non-blocking read coming back empty is how the
+    // event engine and other drains know they're done, not a timeout.
+    if (result == 0 && timeout_ms != 0) {
+        stats_add (&device->stats.read_timeouts, 1);
+    }
+
+    return result;
+}
+
+int infdevice_try_read_key (infdevice_t *device, infkey_t *out_key)
+{
+    return infdevice_read_key_timeout (device, 0, out_key);
+}
+
+inftransport_t* infdevice_acquire_transport (infdevice_t *device)
+{
+    return acquire_transport (device);
+}
+
+void infdevice_release_transport (infdevice_t *device, inftransport_t *transport)
+{
+    release_transport (device, transport);
+}
+
+const char* infdevice_get_backend_name (infdevice_t *device)
+{
+    return device->backend_name;
+}
+
+bool infdevice_is_connected (infdevice_t *device)
+{
+    return atomic_load (&device->connected);
+}
+
+// Must be called with `input.lock` held
+static int start_watching_fd (infdevice_t *device)
+{
+    if (device->input.epoll_fd >= 0) {
+        return device->input.epoll_fd;
+    }
+
+    int epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        return -1;
+    }
+
+    device->input.epoll_fd = epoll_fd;
+
+    // Later transports are added as the keypad reconnects
+    inftransport_t *transport = acquire_transport (device);
+    if (transport) {
+        struct epoll_event event = {
+            .events = EPOLLIN,
+            .data.fd = transport->ops->get_fd (transport)
+        };
+        epoll_ctl (epoll_fd, EPOLL_CTL_ADD, event.data.fd, &event);
+        release_transport (device, transport);
+    }
+
+    return epoll_fd;
+}
+
+// Must be called with `input.lock` held
+static int start_input_pump (infdevice_t *device)
+{
+    if (atomic_load (&device->input.running)) {
+        return device->input.pipe_fds[0];
+    }
+
+    int fds[2];
+    if (pipe (fds) != 0) {
+        return -1;
+    }
+
+    fcntl (fds[0], F_SETFL, fcntl (fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl (fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl (fds[1], F_SETFD, FD_CLOEXEC);
+    device->input.pipe_fds[0] = fds[0];
+    device->input.pipe_fds[1] = fds[1];
+
+    if (pthread_create (&device->input.thread, NULL, input_pump_main, device) != 0) {
+        fprintf (stderr, "Unable to start input thread\n");
+        close (fds[0]);
+        close (fds[1]);
+        device->input.pipe_fds[0] = -1;
+        device->input.pipe_fds[1] = -1;
+        return -1;
+    }
+
+    atomic_store (&device->input.running, true);
+
+    return fds[0];
+}
+
+int infdevice_get_fd (infdevice_t *device)
+{
+    pthread_mutex_lock (&device->input.lock);
+
+    int fd = -1;
+    if (device->transport_has_fd) {
+        fd = start_watching_fd (device);
+    } else {
+        fd = start_input_pump (device);
+    }
+
+    pthread_mutex_unlock (&device->input.lock);
 
-    return input_event.key_state;
+    return fd;
 }
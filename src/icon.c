@@ -0,0 +1,446 @@
+/*
+ * icon.c
+ *
+ * BMP and PNG decoding, see icon.h
+ */
+
+#include "icon.h"
+
+#include <infinitton/pixmap.h>
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define BMP_FILE_HEADER_SIZE   14
+#define BMP_CORE_HEADER_SIZE   12  // OS/2 BITMAPCOREHEADER
+#define BMP_INFO_HEADER_SIZE   40  // BITMAPINFOHEADER, later versions only append fields
+
+// Compression methods, anything else (RLE, embedded JPEG/PNG) is rejected
+#define BMP_BI_RGB             0
+#define BMP_BI_BITFIELDS       3
+#define BMP_BI_ALPHABITFIELDS  6
+
+static const unsigned char png_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+// BMP fields are little-endian and rarely aligned
+static uint16_t read_u16 (const unsigned char *p)
+{
+    return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static uint32_t read_u32 (const unsigned char *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// One color channel of a 16 or 32-bit pixel, as described by its bit mask
+typedef struct {
+    uint32_t     mask;
+    unsigned int shift;
+    uint32_t     max;  // the channel's largest value, once shifted down
+} channel_t;
+
+static channel_t make_channel (uint32_t mask)
+{
+    channel_t channel = { .mask = mask, .shift = 0, .max = 0 };
+    if (mask == 0) {
+        return channel;
+    }
+
+    while (!(mask & 1)) {
+        mask >>= 1;
+        channel.shift++;
+    }
+    channel.max = mask;
+
+    return channel;
+}
+
+// Extracts a channel from a pixel, widened or narrowed to 8 bits
+static inline uint32_t channel_value (const channel_t *channel, uint32_t pixel)
+{
+    if (channel->max == 0) {
+        return 0;
+    }
+
+    const uint64_t value = (pixel & channel->mask) >> channel->shift;
+    return (uint32_t) ((value * 255 + channel->max / 2) / channel->max);
+}
+
+typedef struct {
+    int32_t              width;
+    int32_t              height;
+    bool                 top_down;
+    unsigned int         bpp;
+
+    // Indexed formats
+    const unsigned char *palette;
+    unsigned int         palette_entry_size;  // 3 for core headers, 4 otherwise
+    unsigned int         num_colors;
+
+    // 16 and 32-bit formats
+    channel_t            red;
+    channel_t            green;
+    channel_t            blue;
+    channel_t            alpha;
+
+    const unsigned char *pixels;  // the bottom row, unless `top_down`
+    size_t               stride;
+} bmp_t;
+
+// Validates the headers of a BMP file and everything they point to, filling in `bmp`
+static bool parse_bmp (const unsigned char *data, size_t size, bmp_t *bmp)
+{
+    memset (bmp, 0, sizeof (*bmp));
+
+    if (size < BMP_FILE_HEADER_SIZE + 4) {
+        fprintf (stderr, "BMP file is truncated\n");
+        return false;
+    }
+
+    const uint32_t data_offset = read_u32 (data + 10);
+    const uint32_t header_size = read_u32 (data + BMP_FILE_HEADER_SIZE);
+    const unsigned char *header = data + BMP_FILE_HEADER_SIZE;
+
+    if (header_size != BMP_CORE_HEADER_SIZE && header_size < BMP_INFO_HEADER_SIZE) {
+        fprintf (stderr, "Unsupported BMP header (%u bytes)\n", header_size);
+        return false;
+    }
+    if ((uint64_t) BMP_FILE_HEADER_SIZE + header_size > size) {
+        fprintf (stderr, "BMP file is truncated\n");
+        return false;
+    }
+
+    int64_t height;
+    unsigned int planes;
+    uint32_t compression = BMP_BI_RGB;
+    uint32_t colors_used = 0;
+    if (header_size == BMP_CORE_HEADER_SIZE) {
+        bmp->width = read_u16 (header + 4);
+        height = read_u16 (header + 6);
+        planes = read_u16 (header + 8);
+        bmp->bpp = read_u16 (header + 10);
+        bmp->palette_entry_size = 3;
+    } else {
+        bmp->width = (int32_t) read_u32 (header + 4);
+        height = (int32_t) read_u32 (header + 8);
+        planes = read_u16 (header + 12);
+        bmp->bpp = read_u16 (header + 14);
+        compression = read_u32 (header + 16);
+        colors_used = read_u32 (header + 32);
+        bmp->palette_entry_size = 4;
+    }
+
+    // A negative height means rows are stored top to bottom
+    bmp->top_down = (height < 0);
+    if (height < 0) {
+        height = -height;
+    }
+
+    if (planes != 1 || bmp->width <= 0 || height == 0 ||
+        bmp->width > ICON_MAX_DIMENSION || height > ICON_MAX_DIMENSION) {
+        fprintf (stderr, "Unsupported BMP dimensions (%dx%lld, %u planes)\n",
+                 bmp->width, (long long) height, planes);
+        return false;
+    }
+    bmp->height = (int32_t) height;
+
+    // Color masks and palette follow the header
+    uint64_t tables = BMP_FILE_HEADER_SIZE + header_size;
+
+    if (compression == BMP_BI_RGB) {
+        switch (bmp->bpp) {
+            case 1: case 2: case 4: case 8: break;
+            case 16:
+                bmp->red = make_channel (0x7c00);
+                bmp->green = make_channel (0x03e0);
+                bmp->blue = make_channel (0x001f);
+                break;
+            case 24: break;
+            case 32:
+                // The fourth byte is unused, not alpha
+                bmp->red = make_channel (0x00ff0000);
+                bmp->green = make_channel (0x0000ff00);
+                bmp->blue = make_channel (0x000000ff);
+                break;
+            default:
+                fprintf (stderr, "Unsupported BMP bit depth (%u)\n", bmp->bpp);
+                return false;
+        }
+    } else if (compression == BMP_BI_BITFIELDS || compression == BMP_BI_ALPHABITFIELDS) {
+        if (bmp->bpp != 16 && bmp->bpp != 32) {
+            fprintf (stderr, "Unsupported BMP bit depth (%u) for bit fields\n", bmp->bpp);
+            return false;
+        }
+
+        // Version 2 headers and later carry the masks, otherwise they follow the header
+        const unsigned char *masks = header + BMP_INFO_HEADER_SIZE;
+        bool has_alpha_mask = (header_size >= BMP_INFO_HEADER_SIZE + 16);
+        if (header_size < BMP_INFO_HEADER_SIZE + 12) {
+            has_alpha_mask = (compression == BMP_BI_ALPHABITFIELDS);
+            tables += has_alpha_mask ? 16 : 12;
+            if (tables > size) {
+                fprintf (stderr, "BMP file is truncated\n");
+                return false;
+            }
+        }
+
+        bmp->red = make_channel (read_u32 (masks));
+        bmp->green = make_channel (read_u32 (masks + 4));
+        bmp->blue = make_channel (read_u32 (masks + 8));
+        if (has_alpha_mask) {
+            bmp->alpha = make_channel (read_u32 (masks + 12));
+        }
+    } else {
+        fprintf (stderr, "Compressed BMP files are not supported (method %u)\n", compression);
+        return false;
+    }
+
+    if (bmp->bpp <= 8) {
+        const unsigned int max_colors = 1u << bmp->bpp;
+        bmp->num_colors = (colors_used == 0 || colors_used > max_colors) ? max_colors : colors_used;
+        bmp->palette = data + tables;
+
+        if (tables + (uint64_t) bmp->num_colors * bmp->palette_entry_size > size) {
+            fprintf (stderr, "BMP palette is truncated\n");
+            return false;
+        }
+    }
+
+    // Rows are padded to 4 bytes, except that the last one may be cut short
+    bmp->stride = (((uint64_t) bmp->width * bmp->bpp + 31) / 32) * 4;
+    const uint64_t last_row_size = ((uint64_t) bmp->width * bmp->bpp + 7) / 8;
+    if ((uint64_t) data_offset + bmp->stride * (bmp->height - 1) + last_row_size > size) {
+        fprintf (stderr, "BMP pixel data is truncated\n");
+        return false;
+    }
+    bmp->pixels = data + data_offset;
+
+    return true;
+}
+
+// Returns pixel `x` of a BMP row as a premultiplied cairo pixel
+static inline uint32_t bmp_pixel (const bmp_t *bmp, const unsigned char *row, int32_t x)
+{
+    uint32_t pixel;
+    switch (bmp->bpp) {
+        case 24: {
+            const unsigned char *bgr = row + x * 3;
+            return 0xff000000 | ((uint32_t) bgr[2] << 16) | ((uint32_t) bgr[1] << 8) | bgr[0];
+        }
+
+        case 16:
+            pixel = read_u16 (row + x * 2);
+            break;
+
+        case 32:
+            pixel = read_u32 (row + x * 4);
+            break;
+
+        default: {
+            // Indexed, most significant bits first. Out of range indices show black.
+            const unsigned int bit = (unsigned int) x * bmp->bpp;
+            const unsigned int index = (row[bit / 8] >> (8 - bmp->bpp - bit % 8)) & ((1u << bmp->bpp) - 1);
+            if (index >= bmp->num_colors) {
+                return 0xff000000;
+            }
+
+            const unsigned char *bgr = bmp->palette + index * bmp->palette_entry_size;
+            return 0xff000000 | ((uint32_t) bgr[2] << 16) | ((uint32_t) bgr[1] << 8) | bgr[0];
+        }
+    }
+
+    uint32_t red = channel_value (&bmp->red, pixel);
+    uint32_t green = channel_value (&bmp->green, pixel);
+    uint32_t blue = channel_value (&bmp->blue, pixel);
+
+    uint32_t alpha = 0xff;
+    if (bmp->alpha.mask != 0) {
+        alpha = channel_value (&bmp->alpha, pixel);
+        red = (red * alpha + 127) / 255;
+        green = (green * alpha + 127) / 255;
+        blue = (blue * alpha + 127) / 255;
+    }
+
+    return (alpha << 24) | (red << 16) | (green << 8) | blue;
+}
+
+static cairo_surface_t* decode_bmp (const unsigned char *data, size_t size)
+{
+    bmp_t bmp;
+    if (!parse_bmp (data, size, &bmp)) {
+        return NULL;
+    }
+
+    const cairo_format_t format = (bmp.alpha.mask != 0) ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24;
+    cairo_surface_t *surface = cairo_image_surface_create (format, bmp.width, bmp.height);
+    if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS) {
+        fprintf (stderr, "Could not allocate a %dx%d surface\n", bmp.width, bmp.height);
+        cairo_surface_destroy (surface);
+        return NULL;
+    }
+
+    unsigned char *surface_data = cairo_image_surface_get_data (surface);
+    const int surface_stride = cairo_image_surface_get_stride (surface);
+
+    for (int32_t y = 0; y < bmp.height; y++) {
+        const int32_t src_row = bmp.top_down ? y : (bmp.height - 1 - y);
+        const unsigned char *row = bmp.pixels + (size_t) src_row * bmp.stride;
+
+        uint32_t *dst = (uint32_t *) (surface_data + (size_t) y * surface_stride);
+        if (bmp.bpp == 24) {
+            // The usual icon format gets a loop of its own
+            for (int32_t x = 0; x < bmp.width; x++, row += 3) {
+                dst[x] = 0xff000000 | ((uint32_t) row[2] << 16) | ((uint32_t) row[1] << 8) | row[0];
+            }
+        } else {
+            for (int32_t x = 0; x < bmp.width; x++) {
+                dst[x] = bmp_pixel (&bmp, row, x);
+            }
+        }
+    }
+
+    cairo_surface_mark_dirty (surface);
+
+    return surface;
+}
+
+#ifdef CAIRO_HAS_PNG_FUNCTIONS
+
+// Feeds cairo's PNG decoder from memory
+typedef struct {
+    const unsigned char *data;
+    size_t               size;
+    size_t               pos;
+} png_reader_t;
+
+static cairo_status_t read_png (void *closure, unsigned char *out, unsigned int length)
+{
+    png_reader_t *reader = (png_reader_t *) closure;
+    if (length > reader->size - reader->pos) {
+        return CAIRO_STATUS_READ_ERROR;
+    }
+
+    memcpy (out, reader->data + reader->pos, length);
+    reader->pos += length;
+
+    return CAIRO_STATUS_SUCCESS;
+}
+
+static cairo_surface_t* decode_png (const unsigned char *data, size_t size)
+{
+    png_reader_t reader = { .data = data, .size = size, .pos = 0 };
+    cairo_surface_t *surface = cairo_image_surface_create_from_png_stream (read_png, &reader);
+
+    const cairo_status_t status = cairo_surface_status (surface);
+    if (status != CAIRO_STATUS_SUCCESS) {
+        fprintf (stderr, "Could not decode PNG file: %s\n", cairo_status_to_string (status));
+        cairo_surface_destroy (surface);
+        return NULL;
+    }
+
+    return surface;
+}
+
+#endif // CAIRO_HAS_PNG_FUNCTIONS
+
+cairo_surface_t* icon_decode (const unsigned char *data, size_t size)
+{
+    if (size >= 2 && data[0] == 'B' && data[1] == 'M') {
+        return decode_bmp (data, size);
+    }
+
+    if (size >= sizeof (png_signature) && memcmp (data, png_signature, sizeof (png_signature)) == 0) {
+#ifdef CAIRO_HAS_PNG_FUNCTIONS
+        return decode_png (data, size);
+#else
+        fprintf (stderr, "PNG files are not supported by this build of cairo\n");
+        return NULL;
+#endif
+    }
+
+    fprintf (stderr, "Unrecognized icon file format\n");
+    return NULL;
+}
+
+cairo_surface_t* icon_fit (cairo_surface_t *image)
+{
+    const int width = cairo_image_surface_get_width (image);
+    const int height = cairo_image_surface_get_height (image);
+    if (width == ICON_WIDTH && height == ICON_HEIGHT &&
+        cairo_image_surface_get_format (image) == CAIRO_FORMAT_RGB24) {
+        return cairo_surface_reference (image);
+    }
+
+    cairo_surface_t *icon = infpixmap_create_surface ();
+    cairo_t *cr = cairo_create (icon);
+
+    cairo_set_source_rgb (cr, 0.0, 0.0, 0.0);
+    cairo_paint (cr);
+
+    // Scale to fit, keeping the aspect ratio
+    const double scale_x = (double) ICON_WIDTH / width;
+    const double scale_y = (double) ICON_HEIGHT / height;
+    const double scale = (scale_x < scale_y) ? scale_x : scale_y;
+
+    cairo_translate (cr, (ICON_WIDTH - width * scale) / 2.0, (ICON_HEIGHT - height * scale) / 2.0);
+    cairo_scale (cr, scale, scale);
+
+    // GOOD averages every source pixel when shrinking. Padding keeps the edges from fading
+    // into the background, and the rectangle keeps the padding from filling the margins.
+    cairo_set_source_surface (cr, image, 0, 0);
+    cairo_pattern_set_filter (cairo_get_source (cr), CAIRO_FILTER_GOOD);
+    cairo_pattern_set_extend (cairo_get_source (cr), CAIRO_EXTEND_PAD);
+    cairo_rectangle (cr, 0, 0, width, height);
+    cairo_fill (cr);
+
+    cairo_destroy (cr);
+    cairo_surface_flush (icon);
+
+    return icon;
+}
+
+cairo_surface_t* icon_load_file (const char *file_path)
+{
+    int fd = open (file_path, O_RDONLY);
+    if (fd < 0) {
+        fprintf (stderr, "Couldnt open icon file for reading\n");
+        return NULL;
+    }
+
+    struct stat st_buf;
+    if (fstat (fd, &st_buf) != 0 || !S_ISREG (st_buf.st_mode) || st_buf.st_size == 0) {
+        fprintf (stderr, "Could not stat icon file, or it is empty\n");
+        close (fd);
+        return NULL;
+    }
+
+    // Mapped rather than read, the decoders only look at each byte once
+    const size_t size = st_buf.st_size;
+    void *mapping = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+
+    if (mapping == MAP_FAILED) {
+        fprintf (stderr, "Could not map icon file\n");
+        return NULL;
+    }
+
+    cairo_surface_t *image = icon_decode ((const unsigned char *) mapping, size);
+    munmap (mapping, size);
+
+    if (image == NULL) {
+        return NULL;
+    }
+
+    cairo_surface_t *icon = icon_fit (image);
+    cairo_surface_destroy (image);
+
+    return icon;
+}
@@ -0,0 +1,32 @@
+/*
+ * icon.h
+ *
+ * Decoding of icon files into cairo surfaces, used by `infpixmap_open_file` and atlases
+ */
+
+#pragma once
+
+#include <infinitton/pixmap.h>
+
+#include <cairo/cairo.h>
+#include <stddef.h>
+
+// Largest width or height accepted from a file
+#define ICON_MAX_DIMENSION  8192
+
+// How an upright icon is turned into the stream: BMP rows go bottom to top and the stream is
+// written mirrored, so it is half a turn away. A 72x72 24-bit file comes out with its own
+// pixel data this way.
+#define ICON_FILE_ORIENTATION  INF_ORIENTATION_180
+
+// Decodes a BMP or PNG file held in memory into a surface of the file's own size, upright.
+// Images with alpha become ARGB32, everything else RGB24. Returns NULL, after saying why on
+// stderr, if the data isn't a well-formed file of a supported kind.
+extern cairo_surface_t* icon_decode (const unsigned char *data, size_t size);
+
+// Returns a 72x72 RGB24 surface with `image` scaled to fit, centered on black, and composited
+// over black if it has alpha. Images that already fit are returned as a new reference.
+extern cairo_surface_t* icon_fit (cairo_surface_t *image);
+
+// Maps and decodes the file at `file_path`, and returns it fitted as by `icon_fit`, or NULL
+extern cairo_surface_t* icon_load_file (const char *file_path);
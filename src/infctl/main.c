@@ -8,16 +8,17 @@
 
 #include <pango/pangocairo.h>
 
-#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 static void test_dynamic_pixmap (infdevice_t *device, char **args);
 static void test_pixmap_bmp (infdevice_t *device, char **argv);
 static void test_reading (infdevice_t *device, char **argv);
+static void bench_panel_refresh (infdevice_t *device, char **argv);
 
 typedef struct {
     const char *name;
@@ -28,21 +29,25 @@ static command_t __commands[] = {
     { "pixmap", test_dynamic_pixmap },
     { "bmp",    test_pixmap_bmp },
     { "read",   test_reading },
+    { "bench",  bench_panel_refresh },
 };
 
 static void print_usage (const char *progname)
 {
     fprintf (stderr, "Usage: %s [command] [arguments...]\n", progname);
     fprintf (stderr, "Commands: \n");
-    fprintf (stderr, "\tbmp [key_id] [bmp_file]: Load BMP file\n");
-    fprintf (stderr, "\t\tBMP file must be 72x72, 24-bits (R8 G8 B8), no colorspace info\n");
+    fprintf (stderr, "\tlist: List connected keypads\n");
+    fprintf (stderr, "\tbmp [key_id] [image_file]: Load a BMP or PNG file\n");
+    fprintf (stderr, "\t\tBMP files may use any bit depth, but no compression\n");
+    fprintf (stderr, "\t\tImages that aren't 72x72 are scaled to fit and centered on black\n");
     fprintf (stderr, "\tpixmap: Test dynamically generated pixmaps\n");
     fprintf (stderr, "\tread [dtmf tones dir]: Test reading input pretending to be a phone pad\n");
+    fprintf (stderr, "\tbench [iterations]: Measure full-panel refresh time\n");
 }
 
 static void test_dynamic_pixmap (infdevice_t *device, char **args)
 {
-    infpixmap_t *pixmap = infpixmap_create ();
+    infpixmap_t *pixmap = infpixmap_create_wire ();
 
     cairo_surface_t *surface = infpixmap_create_surface ();
     cairo_t *cr = cairo_create (surface);
@@ -95,12 +100,11 @@ static void test_pixmap_bmp (infdevice_t *device, char **argv)
 
 static void test_reading (infdevice_t *device, char **argv)
 {
-    infpixmap_t *pixmap = infpixmap_create ();
-
-    cairo_surface_t *surface = infpixmap_create_surface ();
-    cairo_t *cr = cairo_create (surface);
-
+    // Keys are drawn straight into the device's surfaces, and uploaded from there
+    cairo_t *cr = cairo_create (infdevice_get_key_surface (device, INF_KEY_0));
     PangoLayout *layout = pango_cairo_create_layout (cr);
+    cairo_destroy (cr);
+
     PangoFontDescription *font = pango_font_description_from_string ("Sans 24");
     if (font == NULL) {
         fprintf (stderr, "Could not find font\n");
@@ -128,17 +132,17 @@ static void test_reading (infdevice_t *device, char **argv)
     pango_layout_set_font_description (layout, font);
     pango_font_description_free (font);
 
+    // Labels are drawn upright, the device turns them to match the pad
+    infdevice_set_orientation (device, INF_ORIENTATION_90);
+
     infkey_t pressed_key = INF_KEY_CLEARED;
     for (;;) {
         for (unsigned int keynum = 0; keynum < INF_NUM_KEYS; keynum++) {
             infkey_t key = infkey_num_to_key (keynum);
             bool highlighted = (key & pressed_key);
 
-            // Rotate 90 deg
-            cairo_save (cr);
-            cairo_translate (cr, ICON_WIDTH / 2, ICON_HEIGHT / 2);
-            cairo_rotate (cr, M_PI_2);
-            cairo_translate (cr, -ICON_WIDTH / 2, -ICON_HEIGHT / 2);
+            cr = cairo_create (infdevice_get_key_surface (device, key));
+            pango_cairo_update_layout (cr, layout);
 
             // Background color
             cairo_set_source_rgb (cr, 0.0, 0.0, 0.0);
@@ -166,10 +170,8 @@ static void test_reading (infdevice_t *device, char **argv)
             cairo_move_to (cr, (ICON_WIDTH - width) / 2.0, (ICON_HEIGHT - height) / 2.0);
             pango_cairo_show_layout (cr, layout);
 
-            infpixmap_update_with_surface (pixmap, surface);
-            infdevice_set_pixmap_for_key_id (device, key, pixmap);
-
-            cairo_restore (cr);
+            cairo_destroy (cr);
+            infdevice_upload_key_surface (device, key);
         }
 
         pressed_key = infdevice_read_key (device);
@@ -195,9 +197,108 @@ static void test_reading (infdevice_t *device, char **argv)
             system (command_str);
         }
     }
+}
 
-    infpixmap_free (pixmap);
-    cairo_surface_destroy (surface);
+static double elapsed_ms (const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static void print_histogram (const char *name, const infstats_histogram_t *histogram)
+{
+    if (histogram->count == 0) {
+        printf ("\t%-10s -\n", name);
+        return;
+    }
+
+    printf ("\t%-10s %8llu samples, mean %8.1f us, max %8.1f us\n", name,
+            (unsigned long long) histogram->count,
+            histogram->total_ns / 1000.0 / histogram->count,
+            histogram->max_ns / 1000.0);
+}
+
+static void bench_panel_refresh (infdevice_t *device, char **argv)
+{
+    int iterations = (argv[1] != NULL) ? atoi (argv[1]) : 20;
+    if (iterations <= 0) {
+        iterations = 20;
+    }
+
+    infpixmap_t *pixmaps[INF_NUM_KEYS];
+    infdevice_update_t updates[INF_NUM_KEYS];
+    for (unsigned int keynum = 0; keynum < INF_NUM_KEYS; keynum++) {
+        pixmaps[keynum] = infpixmap_create ();
+        updates[keynum] = (infdevice_update_t) {
+            .key_id = infkey_num_to_key (keynum),
+            .pixmap = pixmaps[keynum]
+        };
+    }
+
+    // Every pass paints new contents, so no upload is skipped as unchanged
+    unsigned char shade = 0;
+    double sequential_ms = 0.0;
+    double batched_ms = 0.0;
+    for (int i = 0; i < iterations; i++) {
+        for (unsigned int keynum = 0; keynum < INF_NUM_KEYS; keynum++) {
+            size_t length = 0;
+            unsigned char *image = infpixmap_get_image_data (pixmaps[keynum], &length);
+            memset (image, shade++, length);
+        }
+
+        struct timespec start;
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        for (unsigned int keynum = 0; keynum < INF_NUM_KEYS; keynum++) {
+            infdevice_set_pixmap_for_key_id (device, updates[keynum].key_id, pixmaps[keynum]);
+        }
+        sequential_ms += elapsed_ms (&start);
+
+        for (unsigned int keynum = 0; keynum < INF_NUM_KEYS; keynum++) {
+            size_t length = 0;
+            unsigned char *image = infpixmap_get_image_data (pixmaps[keynum], &length);
+            memset (image, shade++, length);
+        }
+
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        infdevice_set_pixmaps (device, updates, INF_NUM_KEYS);
+        batched_ms += elapsed_ms (&start);
+    }
+
+    printf ("Panel refresh (%d iterations):\n", iterations);
+    printf ("\tsequential: %.2f ms\n", sequential_ms / iterations);
+    printf ("\tbatched:    %.2f ms\n", batched_ms / iterations);
+
+    infdevice_stats_t stats;
+    infdevice_get_stats (device, &stats);
+
+    printf ("Where the time went:\n");
+    print_histogram ("encode", &stats.encode);
+    print_histogram ("write", &stats.write);
+    print_histogram ("pacing", &stats.pacing);
+    print_histogram ("feature", &stats.feature);
+    printf ("\t%llu bytes sent, %llu failed and %llu short writes\n",
+            (unsigned long long) stats.bytes_sent,
+            (unsigned long long) stats.failed_writes,
+            (unsigned long long) stats.short_writes);
+
+    for (unsigned int keynum = 0; keynum < INF_NUM_KEYS; keynum++) {
+        infpixmap_free (pixmaps[keynum]);
+    }
+}
+
+static void list_devices (void)
+{
+    infdevice_info_t devices[16];
+    const size_t count = infdevice_enumerate (INF_BACKEND_DEFAULT, devices, 16);
+    for (size_t i = 0; i < count && i < 16; i++) {
+        printf ("%s\t%s\n", devices[i].path, devices[i].serial[0] ? devices[i].serial : "(no serial)");
+    }
+
+    if (count == 0) {
+        fprintf (stderr, "No keypads found\n");
+    }
 }
 
 int main (int argc, char **argv)
@@ -207,6 +308,12 @@ int main (int argc, char **argv)
         return 1;
     }
 
+    // Doesn't need a device open
+    if (strcmp (argv[1], "list") == 0) {
+        list_devices ();
+        return 0;
+    }
+
     infdevice_t *device = infdevice_open ();
     if (!device) {
         fprintf(stderr, "Could not open device\n");
@@ -0,0 +1,329 @@
+/*
+ * input.c
+ *
+ * Key event engine on top of `infdevice_try_read_key`
+ */
+
+#include <infinitton/input.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+// Events that can be waiting at once. A single key state change yields at most one per key.
+#define EVENT_QUEUE_SIZE 64
+
+#define NSEC_PER_MSEC  1000000ULL
+#define NO_DEADLINE    UINT64_MAX
+
+typedef struct {
+    unsigned int long_press_msec;
+    unsigned int repeat_delay_msec;
+    unsigned int repeat_interval_msec;
+
+    // State of the current hold
+    bool         down;
+    bool         long_press_sent;
+    uint64_t     down_ns;
+    uint64_t     next_repeat_ns;
+    unsigned int repeat_count;
+} key_timing_t;
+
+struct infinput_t_ {
+    infdevice_t  *device;
+
+    // Watches both the device and `timer_fd`
+    int           epoll_fd;
+
+    // Armed for the earliest long-press or repeat deadline of any held key
+    int           timer_fd;
+    uint64_t      armed_ns;
+
+    infkey_t      key_state;
+    key_timing_t  keys[INF_NUM_KEYS];
+
+    infevent_t    queue[EVENT_QUEUE_SIZE];
+    unsigned int  queue_head;
+    unsigned int  queue_len;
+};
+
+static uint64_t now_ns (void)
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void push_event (infinput_t      *input,
+                        infevent_type_t  type,
+                        int              keynum,
+                        uint64_t         timestamp_ns,
+                        unsigned int     repeat_count)
+{
+    if (input->queue_len == EVENT_QUEUE_SIZE) {
+        fprintf (stderr, "Dropped key event, reader is not keeping up\n");
+        return;
+    }
+
+    const unsigned int tail = (input->queue_head + input->queue_len) % EVENT_QUEUE_SIZE;
+    input->queue[tail] = (infevent_t) {
+        .type = type,
+        .key_id = infkey_num_to_key (keynum),
+        .timestamp_ns = timestamp_ns,
+        .repeat_count = repeat_count
+    };
+    input->queue_len++;
+}
+
+static bool pop_event (infinput_t *input, infevent_t *out_event)
+{
+    if (input->queue_len == 0) {
+        return false;
+    }
+
+    *out_event = input->queue[input->queue_head];
+    input->queue_head = (input->queue_head + 1) % EVENT_QUEUE_SIZE;
+    input->queue_len--;
+
+    return true;
+}
+
+static uint64_t long_press_deadline (const key_timing_t *key)
+{
+    if (!key->down || key->long_press_sent || key->long_press_msec == 0) {
+        return NO_DEADLINE;
+    }
+
+    return key->down_ns + key->long_press_msec * NSEC_PER_MSEC;
+}
+
+static uint64_t repeat_deadline (const key_timing_t *key)
+{
+    if (!key->down || key->repeat_interval_msec == 0) {
+        return NO_DEADLINE;
+    }
+
+    return key->next_repeat_ns;
+}
+
+// Queues every long-press and repeat that is due by `now`
+static void fire_timers (infinput_t *input, uint64_t now)
+{
+    for (int i = 0; i < INF_NUM_KEYS; i++) {
+        key_timing_t *key = &input->keys[i];
+
+        const uint64_t long_press = long_press_deadline (key);
+        if (long_press <= now) {
+            key->long_press_sent = true;
+            push_event (input, INF_EVENT_LONG_PRESS, i, long_press, 0);
+        }
+
+        const uint64_t repeat = repeat_deadline (key);
+        if (repeat <= now) {
+            push_event (input, INF_EVENT_REPEAT, i, repeat, ++key->repeat_count);
+
+            // Keep the cadence, but don't make up for intervals missed while nobody was reading
+            const uint64_t interval = key->repeat_interval_msec * NSEC_PER_MSEC;
+            do {
+                key->next_repeat_ns += interval;
+            } while (key->next_repeat_ns <= now);
+        }
+    }
+}
+
+static void arm_timer (infinput_t *input)
+{
+    uint64_t deadline = NO_DEADLINE;
+    for (int i = 0; i < INF_NUM_KEYS; i++) {
+        const uint64_t long_press = long_press_deadline (&input->keys[i]);
+        const uint64_t repeat = repeat_deadline (&input->keys[i]);
+        if (long_press < deadline) deadline = long_press;
+        if (repeat < deadline) deadline = repeat;
+    }
+
+    if (deadline == NO_DEADLINE) {
+        deadline = 0; // disarms
+    }
+
+    if (deadline == input->armed_ns) {
+        return;
+    }
+
+    struct itimerspec spec = { 0 };
+    spec.it_value.tv_sec = deadline / 1000000000ULL;
+    spec.it_value.tv_nsec = deadline % 1000000000ULL;
+    timerfd_settime (input->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+
+    input->armed_ns = deadline;
+}
+
+static void handle_key_state (infinput_t *input, infkey_t state, uint64_t timestamp)
+{
+    // Timers that expired before this change still go first
+    fire_timers (input, timestamp);
+
+    const infkey_t changed = state ^ input->key_state;
+    for (int i = 0; i < INF_NUM_KEYS; i++) {
+        const infkey_t key_id = infkey_num_to_key (i);
+        if (!(changed & key_id)) continue;
+
+        key_timing_t *key = &input->keys[i];
+        if (state & key_id) {
+            key->down = true;
+            key->long_press_sent = false;
+            key->down_ns = timestamp;
+            key->next_repeat_ns = timestamp + key->repeat_delay_msec * NSEC_PER_MSEC;
+            key->repeat_count = 0;
+            push_event (input, INF_EVENT_PRESS, i, timestamp, 0);
+        } else {
+            key->down = false;
+            push_event (input, INF_EVENT_RELEASE, i, timestamp, 0);
+        }
+    }
+
+    input->key_state = state;
+}
+
+// Collects everything that happened since the last call. Returns false if the device failed.
+static bool collect_events (infinput_t *input)
+{
+    infkey_t state;
+    int result;
+    while ((result = infdevice_try_read_key (input->device, &state)) > 0) {
+        handle_key_state (input, state, now_ns ());
+    }
+
+    fire_timers (input, now_ns ());
+    arm_timer (input);
+
+    return (result == 0);
+}
+
+infinput_t* infinput_create (infdevice_t *device)
+{
+    const int device_fd = infdevice_get_fd (device);
+    if (device_fd < 0) {
+        return NULL;
+    }
+
+    infinput_t *input = (infinput_t *) calloc (1, sizeof (infinput_t));
+    if (input == NULL) {
+        return NULL;
+    }
+
+    input->device = device;
+    input->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    input->timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (input->epoll_fd < 0 || input->timer_fd < 0) {
+        infinput_free (input);
+        return NULL;
+    }
+
+    struct epoll_event event = { .events = EPOLLIN };
+
+    event.data.fd = device_fd;
+    if (epoll_ctl (input->epoll_fd, EPOLL_CTL_ADD, device_fd, &event) != 0) {
+        infinput_free (input);
+        return NULL;
+    }
+
+    event.data.fd = input->timer_fd;
+    if (epoll_ctl (input->epoll_fd, EPOLL_CTL_ADD, input->timer_fd, &event) != 0) {
+        infinput_free (input);
+        return NULL;
+    }
+
+    return input;
+}
+
+void infinput_free (infinput_t *input)
+{
+    if (input->timer_fd >= 0) {
+        close (input->timer_fd);
+    }
+
+    if (input->epoll_fd >= 0) {
+        close (input->epoll_fd);
+    }
+
+    free (input);
+}
+
+void infinput_set_long_press (infinput_t *input, infkey_t keys, unsigned int delay_msec)
+{
+    for (int i = 0; i < INF_NUM_KEYS; i++) {
+        if (keys & infkey_num_to_key (i)) {
+            input->keys[i].long_press_msec = delay_msec;
+        }
+    }
+}
+
+void infinput_set_repeat (infinput_t  *input,
+                          infkey_t     keys,
+                          unsigned int delay_msec,
+                          unsigned int interval_msec)
+{
+    for (int i = 0; i < INF_NUM_KEYS; i++) {
+        if (keys & infkey_num_to_key (i)) {
+            input->keys[i].repeat_delay_msec = delay_msec;
+            input->keys[i].repeat_interval_msec = interval_msec;
+        }
+    }
+}
+
+int infinput_get_fd (infinput_t *input)
+{
+    return input->epoll_fd;
+}
+
+int infinput_next_event (infinput_t *input, int timeout_ms, infevent_t *out_event)
+{
+    const uint64_t start = now_ns ();
+
+    for (;;) {
+        if (pop_event (input, out_event)) {
+            return 1;
+        }
+
+        if (!collect_events (input)) {
+            return -1;
+        }
+
+        if (pop_event (input, out_event)) {
+            return 1;
+        }
+
+        int remaining = -1;
+        if (timeout_ms >= 0) {
+            const uint64_t elapsed = (now_ns () - start) / NSEC_PER_MSEC;
+            if (elapsed >= (uint64_t) timeout_ms) {
+                return 0;
+            }
+
+            remaining = timeout_ms - (int) elapsed;
+        }
+
+        struct epoll_event events[2];
+        if (epoll_wait (input->epoll_fd, events, 2, remaining) < 0 && errno != EINTR) {
+            return -1;
+        }
+
+        // The deadline it fired for is found again by `fire_timers`
+        uint64_t expirations;
+        if (read (input->timer_fd, &expirations, sizeof (expirations)) > 0) {
+            input->armed_ns = 0;
+        }
+    }
+}
+
+infkey_t infinput_get_key_state (infinput_t *input)
+{
+    return input->key_state;
+}
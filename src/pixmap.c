@@ -6,155 +6,364 @@
 
 #include <infinitton/pixmap.h>
 
+#include "convert.h"
+#include "icon.h"
+#include "wire.h"
+
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/types.h>
-#include <sys/stat.h>
+
+#define BYTES_PER_PIXEL  3
+#define ROW_SIZE         (ICON_WIDTH * BYTES_PER_PIXEL)
+#define IMAGE_SIZE       (ROW_SIZE * ICON_HEIGHT)
+
+// Pixmap buffers start on a cache line
+#define PIXMAP_ALIGNMENT  64
 
 struct infpixmap_t_ {
     unsigned char *data;
-    size_t         size;
+    size_t         size;  // size of the BMP stream, header included
 
     int32_t        imgdata_offset;
+
+    // When set, `data` is a frame_reports_t holding the BMP stream split across
+    // the two data reports, rather than the stream itself.
+    bool           wire;
+
+    // Set for pixmaps handed out by a pool, which `infpixmap_free` returns them to
+    infpixmap_pool_t    *pool;
+    struct infpixmap_t_ *next_free;
+
+    // Set for views over frames owned by someone else, which `infpixmap_free` leaves alone
+    bool                 borrowed;
 };
 
-infpixmap_t* infpixmap_open_file (const char *file_path)
+// A batch of pooled pixmaps, allocated together whenever a pool runs dry
+typedef struct pool_slab_t_ {
+    struct pool_slab_t_ *next;
+    unsigned char       *buffers;
+    struct infpixmap_t_  pixmaps[];
+} pool_slab_t;
+
+struct infpixmap_pool_t_ {
+    bool          wire;
+    size_t        slab_capacity;
+    pool_slab_t  *slabs;
+    infpixmap_t  *free_list;
+};
+
+typedef struct __attribute__((__packed__)) {
+    unsigned char header[2];
+    int32_t size;
+
+    unsigned char reserved[4];
+    int32_t data_offset;
+} bmp_file_header_t;
+
+typedef struct __attribute__((__packed__)) {
+    int32_t header_size;
+    int32_t width;
+    int32_t height;
+    
+    int16_t num_color_planes;
+    int16_t bpp; // bits per pixel
+    
+    int32_t comp_method;
+    int32_t image_size;
+    int32_t horiz_resolution;
+    int32_t vert_resolution;
+    int32_t num_colors; // number of colors in palette
+    int32_t important_colors;
+} bmp_info_header_t;
+
+typedef struct __attribute__((__packed__)) {
+    bmp_file_header_t file;
+    bmp_info_header_t info;
+} bmp_header_t;
+
+#define BMP_HEADER_SIZE  (sizeof (bmp_header_t))
+
+// Every pixmap starts with this header, so it is only ever copied
+static const bmp_header_t bmp_header = {
+    .file = {
+        .header = { 'B', 'M' },
+        .size = IMAGE_SIZE,
+        .data_offset = sizeof (bmp_header_t),
+    },
+    .info = {
+        .header_size = sizeof (bmp_info_header_t),
+        .width = ICON_WIDTH,
+        .height = ICON_HEIGHT,
+        .num_color_planes = 1,
+        .bpp = 24,
+        .comp_method = 0, // BI_RGB
+        .image_size = IMAGE_SIZE,
+    },
+};
+
+// Size of the buffer behind a pixmap, rounded up so that whatever follows it stays aligned
+static size_t buffer_size (bool wire)
 {
-    // Obtain size of BMP
-    struct stat st_buf;
-    int status = stat (file_path, &st_buf);
-    if (status != 0) {
-        fprintf (stderr, "Could not stat bmp file\n");
-        return NULL;
-    }
+    const size_t size = wire ? sizeof (frame_reports_t) : BMP_HEADER_SIZE + IMAGE_SIZE;
+    return (size + PIXMAP_ALIGNMENT - 1) & ~((size_t) PIXMAP_ALIGNMENT - 1);
+}
 
-    const unsigned long size = st_buf.st_size;
+// Stamps an empty icon into `buffer` and sets `pixmap` up around it
+static void init_pixmap (infpixmap_t *pixmap, unsigned char *buffer, bool wire)
+{
+    if (wire) {
+        frame_reports_t *reports = (frame_reports_t *) buffer;
+        memset (reports, 0, sizeof (frame_reports_t));
 
-    FILE *f = fopen (file_path, "r");
-    if (f == NULL) {
-        fprintf (stderr, "Couldnt open bmp file for reading\n");
-        return 0;
+        // The BMP header always fits in the first chunk
+        memcpy (reports->chunks[0] + CHUNK_HEADER_SIZE, &bmp_header, BMP_HEADER_SIZE);
+        wire_write_headers (reports, BMP_HEADER_SIZE + IMAGE_SIZE);
+    } else {
+        memcpy (buffer, &bmp_header, BMP_HEADER_SIZE);
+        memset (buffer + BMP_HEADER_SIZE, 0, IMAGE_SIZE);
     }
 
-    // Read the whole thing into memory, should be small
-    unsigned char *buf = (unsigned char *)malloc (size);
-    size_t read = fread(buf, size, 1, f);
-    fclose(f);
+    pixmap->data = buffer;
+    pixmap->size = BMP_HEADER_SIZE + IMAGE_SIZE;
+    pixmap->imgdata_offset = BMP_HEADER_SIZE;
+    pixmap->wire = wire;
+    pixmap->pool = NULL;
+    pixmap->next_free = NULL;
+    pixmap->borrowed = false;
+}
+
+// Unpooled pixmaps are a single block: the buffer, followed by the pixmap itself
+static infpixmap_t* create_pixmap (bool wire)
+{
+    const size_t size = buffer_size (wire);
 
-    if (read <= 0) {
-        fprintf (stderr, "Got no bytes\n");
-        return 0;
+    void *block = NULL;
+    if (posix_memalign (&block, PIXMAP_ALIGNMENT, size + sizeof (struct infpixmap_t_)) != 0) {
+        return NULL;
     }
 
-    struct infpixmap_t_ *pixmap = (struct infpixmap_t_ *)malloc (sizeof (struct infpixmap_t_));
-    pixmap->data = buf;
-    pixmap->size = size;
-    pixmap->imgdata_offset = -1; // TODO!!
+    infpixmap_t *pixmap = (infpixmap_t *) ((unsigned char *) block + size);
+    init_pixmap (pixmap, (unsigned char *) block, wire);
 
     return pixmap;
 }
 
 infpixmap_t* infpixmap_create ()
 {
-    // Set up the BMP header
-    struct __attribute__((__packed__)) {
-        unsigned char header[2];
-        int32_t size;
-
-        unsigned char reserved[4];
-        int32_t data_offset;
-    } bmp_header;
-
-    struct __attribute__((__packed__)) {
-        int32_t header_size;
-        int32_t width;
-        int32_t height;
-        
-        int16_t num_color_planes;
-        int16_t bpp; // bits per pixel
-        
-        int32_t comp_method;
-        int32_t image_size;
-        int32_t horiz_resolution;
-        int32_t vert_resolution;
-        int32_t num_colors; // number of colors in palette
-        int32_t important_colors;
-    } info_header;
-
-    memset (&bmp_header, 0x00, sizeof (bmp_header));
-    memset (&info_header, 0x00, sizeof (info_header));
-
-    // BM
-    bmp_header.header[0] = 'B'; bmp_header.header[1] = 'M';
-
-    // Compute size of image data
-    const size_t img_size = ICON_WIDTH * ICON_HEIGHT * 3; // 3 bytes per pixel
-    bmp_header.size = img_size;
-
-    // Populate info header
-    info_header.header_size = sizeof (info_header);
-    info_header.width = ICON_WIDTH;
-    info_header.height = ICON_HEIGHT;
-    info_header.num_color_planes = 1;
-    info_header.bpp = 24;
-    info_header.comp_method = 0; // BI_RGB
-    info_header.image_size = img_size;
-    info_header.horiz_resolution = 0; // ???
-    info_header.vert_resolution = 0; // ???
-    info_header.num_colors = 0;
-    info_header.important_colors = 0;
-
-    // Compute size of buffer
-    const size_t header_size = sizeof (bmp_header) + sizeof (info_header);
-    const size_t buf_size = header_size + img_size;
-    bmp_header.data_offset = header_size;
-    
-    // Allocate data buffer
-    unsigned char *data = (unsigned char *) calloc (buf_size, 1);
+    return create_pixmap (false);
+}
 
-    // Copy header
-    memcpy (data, &bmp_header, sizeof (bmp_header));
-    memcpy (data + sizeof (bmp_header), &info_header, sizeof (info_header));
+infpixmap_t* infpixmap_create_wire ()
+{
+    return create_pixmap (true);
+}
 
-    // Create pixmap
-    struct infpixmap_t_ *pixmap = (struct infpixmap_t_ *) malloc (sizeof (struct infpixmap_t_));
-    pixmap->data = data;
-    pixmap->size = buf_size;
-    pixmap->imgdata_offset = bmp_header.data_offset;
+frame_reports_t* infpixmap_get_wire_reports (infpixmap_t *pixmap, size_t *out_stream_size)
+{
+    if (!pixmap->wire) {
+        return NULL;
+    }
 
-    return pixmap;
+    *out_stream_size = pixmap->size;
+    return (frame_reports_t *) pixmap->data;
 }
 
-cairo_surface_t* infpixmap_get_surface (infpixmap_t *pixmap)
+infpixmap_t* wire_create_views (frame_reports_t *frames, size_t count)
 {
-    const int stride = cairo_format_stride_for_width (CAIRO_FORMAT_RGB24, ICON_WIDTH);
-    cairo_surface_t *surface = cairo_image_surface_create_for_data (
-        pixmap->data + pixmap->imgdata_offset,
-        CAIRO_FORMAT_RGB24,
-        ICON_WIDTH,
-        ICON_HEIGHT,
-        stride
-    );
+    const size_t n = (count > 0) ? count : 1;
+    infpixmap_t *views = (infpixmap_t *) calloc (n, sizeof (struct infpixmap_t_));
+    if (views == NULL) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        infpixmap_t *view = &views[i];
+        view->data = (unsigned char *) &frames[i];
+        view->size = BMP_HEADER_SIZE + IMAGE_SIZE;
+        view->imgdata_offset = BMP_HEADER_SIZE;
+        view->wire = true;
+        view->borrowed = true;
+    }
 
-    return surface;
+    return views;
+}
+
+infpixmap_t* wire_view_at (infpixmap_t *views, size_t index)
+{
+    return &views[index];
+}
+
+void wire_free_views (infpixmap_t *views)
+{
+    free (views);
+}
+
+// Where the BMP stream being written lives: either a plain buffer, or the payloads of a
+// frame_reports_t
+typedef struct {
+    unsigned char *data;
+    size_t         size;
+    bool           wire;
+} stream_t;
+
+// Returns where byte `pos` of the BMP stream is stored, and in `out_contiguous` how many
+// bytes from there on are contiguous.
+static unsigned char* stream_at (const stream_t *stream, size_t pos, size_t *out_contiguous)
+{
+    if (!stream->wire) {
+        *out_contiguous = stream->size - pos;
+        return stream->data + pos;
+    }
+
+    frame_reports_t *reports = (frame_reports_t *) stream->data;
+    const size_t chunk = pos / CHUNK_PAYLOAD_SIZE;
+    const size_t offset = pos % CHUNK_PAYLOAD_SIZE;
+
+    *out_contiguous = CHUNK_PAYLOAD_SIZE - offset;
+    return reports->chunks[chunk] + CHUNK_HEADER_SIZE + offset;
 }
 
 unsigned char* infpixmap_get_data (infpixmap_t *pixmap, size_t *out_length)
 {
+    if (pixmap->wire) {
+        *out_length = 0;
+        return NULL;
+    }
+
     *out_length = pixmap->size;
     return pixmap->data;
 }
 
 unsigned char* infpixmap_get_image_data (infpixmap_t *pixmap, size_t *out_length)
 {
+    if (pixmap->wire) {
+        *out_length = 0;
+        return NULL;
+    }
+
     *out_length = (pixmap->size - pixmap->imgdata_offset);
     return (pixmap->data + pixmap->imgdata_offset);
 }
 
 void infpixmap_free (infpixmap_t *pixmap)
 {
+    if (pixmap->borrowed) {
+        return;
+    }
+
+    if (pixmap->pool) {
+        pixmap->next_free = pixmap->pool->free_list;
+        pixmap->pool->free_list = pixmap;
+        return;
+    }
+
+    // The pixmap lives in the same block as its buffer
     free (pixmap->data);
-    free (pixmap);
+}
+
+void infpixmap_clear (infpixmap_t *pixmap)
+{
+    const stream_t stream = {
+        .data = pixmap->data,
+        .size = pixmap->size,
+        .wire = pixmap->wire
+    };
+
+    // At most two runs, either side of the report split
+    size_t pos = pixmap->imgdata_offset;
+    while (pos < pixmap->size) {
+        size_t contiguous = 0;
+        unsigned char *dst = stream_at (&stream, pos, &contiguous);
+        if (contiguous > pixmap->size - pos) {
+            contiguous = pixmap->size - pos;
+        }
+
+        memset (dst, 0, contiguous);
+        pos += contiguous;
+    }
+}
+
+/* Pools */
+
+// Adds a slab of fresh pixmaps to the pool's free list
+static bool pool_grow (infpixmap_pool_t *pool)
+{
+    pool_slab_t *slab = (pool_slab_t *) malloc (sizeof (pool_slab_t) +
+                                                pool->slab_capacity * sizeof (struct infpixmap_t_));
+    if (slab == NULL) {
+        return false;
+    }
+
+    const size_t size = buffer_size (pool->wire);
+
+    void *buffers = NULL;
+    if (posix_memalign (&buffers, PIXMAP_ALIGNMENT, pool->slab_capacity * size) != 0) {
+        free (slab);
+        return false;
+    }
+
+    slab->buffers = (unsigned char *) buffers;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+
+    for (size_t i = 0; i < pool->slab_capacity; i++) {
+        infpixmap_t *pixmap = &slab->pixmaps[i];
+        init_pixmap (pixmap, slab->buffers + i * size, pool->wire);
+
+        pixmap->pool = pool;
+        pixmap->next_free = pool->free_list;
+        pool->free_list = pixmap;
+    }
+
+    return true;
+}
+
+infpixmap_pool_t* infpixmap_pool_create (size_t capacity, bool wire)
+{
+    infpixmap_pool_t *pool = (infpixmap_pool_t *) malloc (sizeof (infpixmap_pool_t));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->wire = wire;
+    pool->slab_capacity = (capacity > 0) ? capacity : 1;
+    pool->slabs = NULL;
+    pool->free_list = NULL;
+
+    if (!pool_grow (pool)) {
+        free (pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+infpixmap_t* infpixmap_pool_get (infpixmap_pool_t *pool)
+{
+    if (pool->free_list == NULL && !pool_grow (pool)) {
+        return NULL;
+    }
+
+    infpixmap_t *pixmap = pool->free_list;
+    pool->free_list = pixmap->next_free;
+    pixmap->next_free = NULL;
+
+    return pixmap;
+}
+
+void infpixmap_pool_free (infpixmap_pool_t *pool)
+{
+    pool_slab_t *slab = pool->slabs;
+    while (slab) {
+        pool_slab_t *next = slab->next;
+        free (slab->buffers);
+        free (slab);
+        slab = next;
+    }
+
+    free (pool);
 }
 
 /* Cairo Extensions */
@@ -164,24 +373,187 @@ cairo_surface_t* infpixmap_create_surface ()
     return cairo_image_surface_create (CAIRO_FORMAT_RGB24, ICON_WIDTH, ICON_HEIGHT);
 }
 
+// Where the source pixel for output row 0, column 0 sits in a surface with the given stride,
+// and how far apart the source pixels of successive output rows and columns are. The output is
+// what the BMP layout needs: the image mirrored horizontally.
+static void orientation_walk (inforientation_t  orientation,
+                              ptrdiff_t         stride,
+                              ptrdiff_t        *out_origin,
+                              ptrdiff_t        *out_row_step,
+                              ptrdiff_t        *out_col_step)
+{
+    const ptrdiff_t last_col = (ICON_WIDTH - 1) * 4;
+    const ptrdiff_t last_row = (ICON_HEIGHT - 1) * stride;
+
+    // Mirroring cancels the BMP mirroring out
+    const bool mirrored = (orientation & INF_ORIENTATION_MIRRORED);
+    switch (orientation & ~INF_ORIENTATION_MIRRORED) {
+        default:
+        case INF_ORIENTATION_0:
+            *out_origin = mirrored ? 0 : last_col;
+            *out_row_step = stride;
+            *out_col_step = mirrored ? 4 : -4;
+            break;
+
+        case INF_ORIENTATION_90:
+            // Output rows are source columns, top to bottom
+            *out_origin = mirrored ? last_col : 0;
+            *out_row_step = mirrored ? -4 : 4;
+            *out_col_step = stride;
+            break;
+
+        case INF_ORIENTATION_180:
+            *out_origin = last_row + (mirrored ? last_col : 0);
+            *out_row_step = -stride;
+            *out_col_step = mirrored ? -4 : 4;
+            break;
+
+        case INF_ORIENTATION_270:
+            // Output rows are source columns, bottom to top
+            *out_origin = last_row + (mirrored ? 0 : last_col);
+            *out_row_step = mirrored ? 4 : -4;
+            *out_col_step = -stride;
+            break;
+    }
+}
+
+void wire_chunk_source_rect (unsigned int      chunk,
+                             inforientation_t  orientation,
+                             unsigned int     *out_x,
+                             unsigned int     *out_y,
+                             unsigned int     *out_width,
+                             unsigned int     *out_height)
+{
+    // Image rows carried by this chunk, the one straddling the split counts for both
+    const size_t start = chunk * CHUNK_PAYLOAD_SIZE;
+    const size_t end = start + CHUNK_PAYLOAD_SIZE;
+    const unsigned int first = (start > BMP_HEADER_SIZE) ? (start - BMP_HEADER_SIZE) / ROW_SIZE : 0;
+    unsigned int last = (end - BMP_HEADER_SIZE - 1) / ROW_SIZE;
+    if (last >= ICON_HEIGHT) {
+        last = ICON_HEIGHT - 1;
+    }
+
+    // Which lines of the surface those rows are read from, see `orientation_walk`
+    const ptrdiff_t stride = ICON_WIDTH * 4;
+    ptrdiff_t origin, row_step, col_step;
+    orientation_walk (orientation, stride, &origin, &row_step, &col_step);
+
+    const bool reversed = (row_step < 0);
+    const unsigned int low = reversed ? (ICON_HEIGHT - 1 - last) : first;
+    const unsigned int count = last - first + 1;
+
+    if (row_step == stride || row_step == -stride) {
+        *out_x = 0;
+        *out_y = low;
+        *out_width = ICON_WIDTH;
+        *out_height = count;
+    } else {
+        *out_x = low;
+        *out_y = 0;
+        *out_width = count;
+        *out_height = ICON_HEIGHT;
+    }
+}
+
 void infpixmap_update_with_surface (infpixmap_t     *pixmap, 
                                     cairo_surface_t *surface)
 {
-    unsigned char *data = pixmap->data;
+    infpixmap_update_with_surface_oriented (pixmap, surface, INF_ORIENTATION_0);
+}
+
+// Converts `surface` into the image data of `stream`, which starts at `imgdata_offset`
+static void convert_surface (const stream_t   *stream,
+                             size_t            imgdata_offset,
+                             cairo_surface_t  *surface,
+                             inforientation_t  orientation)
+{
+    cairo_surface_flush (surface);
 
-    // Convert surface data.
-    // Cairo stores each pixel as a 32-bit quantity, where the upper 8-bits are unused.
-    // For BMP, we need to convert pixels to 24-bit quantities
-    unsigned int offset = pixmap->imgdata_offset;
     const int stride = cairo_image_surface_get_stride (surface);
-    unsigned char *surface_data = cairo_image_surface_get_data (surface);
-    for (unsigned int row = 0; row < ICON_HEIGHT; row++) {
-        for (unsigned int col = 0; col < ICON_WIDTH; col++) {
-            // 4 bytes per pixel in source data
-            unsigned char *pixel = surface_data + (row * stride) + (ICON_WIDTH - col) * 4;
-            data[offset++] = pixel[0] & 0xFF;
-            data[offset++] = pixel[1] & 0xFF;
-            data[offset++] = pixel[2] & 0xFF;
+    const unsigned char *surface_data = cairo_image_surface_get_data (surface);
+
+    // Each output row is one pass of the conversion kernel over a row or column of the
+    // surface, so turning the image is only a matter of where the kernel reads from
+    ptrdiff_t origin, row_step, col_step;
+    orientation_walk (orientation, stride, &origin, &row_step, &col_step);
+
+    const convert_row_func_t convert_row = convert_get_kernel ()->convert_row;
+
+    // Rows are written straight into the stream's storage. For wire layout,
+    // the one row straddling the two reports is converted aside and split.
+    size_t pos = imgdata_offset;
+    for (unsigned int row = 0; row < ICON_HEIGHT; row++, pos += ROW_SIZE) {
+        const unsigned char *src = surface_data + origin + (ptrdiff_t) row * row_step;
+
+        size_t contiguous = 0;
+        unsigned char *dst = stream_at (stream, pos, &contiguous);
+        if (contiguous >= ROW_SIZE) {
+            convert_row (dst, src, col_step);
+        } else {
+            unsigned char converted[ROW_SIZE];
+            convert_row (converted, src, col_step);
+
+            memcpy (dst, converted, contiguous);
+
+            size_t rest = 0;
+            dst = stream_at (stream, pos + contiguous, &rest);
+            memcpy (dst, converted + contiguous, ROW_SIZE - contiguous);
         }
     }
 }
+
+void infpixmap_update_with_surface_oriented (infpixmap_t      *pixmap,
+                                             cairo_surface_t  *surface,
+                                             inforientation_t  orientation)
+{
+    const stream_t stream = {
+        .data = pixmap->data,
+        .size = pixmap->size,
+        .wire = pixmap->wire
+    };
+
+    convert_surface (&stream, pixmap->imgdata_offset, surface, orientation);
+}
+
+size_t wire_encode_surface (frame_reports_t  *reports,
+                            cairo_surface_t  *surface,
+                            inforientation_t  orientation)
+{
+    const size_t stream_size = BMP_HEADER_SIZE + IMAGE_SIZE;
+
+    wire_write_headers (reports, stream_size);
+    memcpy (reports->chunks[0] + CHUNK_HEADER_SIZE, &bmp_header, BMP_HEADER_SIZE);
+
+    // Whatever follows the stream in the last report is sent too, keep it zeroed
+    const size_t tail = stream_size - (NUM_CHUNKS - 1) * CHUNK_PAYLOAD_SIZE;
+    memset (reports->chunks[NUM_CHUNKS - 1] + CHUNK_HEADER_SIZE + tail, 0, CHUNK_PAYLOAD_SIZE - tail);
+
+    const stream_t stream = {
+        .data = (unsigned char *) reports,
+        .size = stream_size,
+        .wire = true
+    };
+
+    convert_surface (&stream, BMP_HEADER_SIZE, surface, orientation);
+
+    return stream_size;
+}
+
+infpixmap_t* infpixmap_open_file (const char *file_path)
+{
+    cairo_surface_t *icon = icon_load_file (file_path);
+    if (icon == NULL) {
+        return NULL;
+    }
+
+    infpixmap_t *pixmap = infpixmap_create ();
+    if (pixmap == NULL) {
+        cairo_surface_destroy (icon);
+        return NULL;
+    }
+
+    infpixmap_update_with_surface_oriented (pixmap, icon, ICON_FILE_ORIENTATION);
+    cairo_surface_destroy (icon);
+
+    return pixmap;
+}
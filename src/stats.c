@@ -0,0 +1,107 @@
+/*
+ * stats.c
+ *
+ * Counters and latency histograms for device operations
+ */
+
+#include "stats.h"
+
+#include <string.h>
+#include <time.h>
+
+static unsigned int bucket_for_duration (uint64_t ns)
+{
+    // floor(log2(ns)), with 0 and 1ns sharing the first bucket
+    unsigned int bucket = 0;
+    while (ns > 1 && bucket < INF_STATS_HISTOGRAM_BUCKETS - 1) {
+        ns >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+static void reset_histogram (stats_histogram_t *histogram)
+{
+    atomic_store_explicit (&histogram->count, 0, memory_order_relaxed);
+    atomic_store_explicit (&histogram->total_ns, 0, memory_order_relaxed);
+    atomic_store_explicit (&histogram->max_ns, 0, memory_order_relaxed);
+    for (unsigned int i = 0; i < INF_STATS_HISTOGRAM_BUCKETS; i++) {
+        atomic_store_explicit (&histogram->buckets[i], 0, memory_order_relaxed);
+    }
+}
+
+static void snapshot_histogram (stats_histogram_t *histogram, infstats_histogram_t *out)
+{
+    out->count = atomic_load_explicit (&histogram->count, memory_order_relaxed);
+    out->total_ns = atomic_load_explicit (&histogram->total_ns, memory_order_relaxed);
+    out->max_ns = atomic_load_explicit (&histogram->max_ns, memory_order_relaxed);
+    for (unsigned int i = 0; i < INF_STATS_HISTOGRAM_BUCKETS; i++) {
+        out->buckets[i] = atomic_load_explicit (&histogram->buckets[i], memory_order_relaxed);
+    }
+}
+
+uint64_t stats_now_ns (void)
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void stats_reset (stats_t *stats)
+{
+    reset_histogram (&stats->encode);
+    reset_histogram (&stats->write);
+    reset_histogram (&stats->pacing);
+    reset_histogram (&stats->feature);
+    reset_histogram (&stats->read_wait);
+
+    atomic_store_explicit (&stats->bytes_sent, 0, memory_order_relaxed);
+    atomic_store_explicit (&stats->failed_writes, 0, memory_order_relaxed);
+    atomic_store_explicit (&stats->short_writes, 0, memory_order_relaxed);
+    atomic_store_explicit (&stats->read_timeouts, 0, memory_order_relaxed);
+    atomic_store_explicit (&stats->skipped_uploads, 0, memory_order_relaxed);
+    atomic_store_explicit (&stats->skipped_reports, 0, memory_order_relaxed);
+    atomic_store_explicit (&stats->disconnects, 0, memory_order_relaxed);
+    atomic_store_explicit (&stats->reconnects, 0, memory_order_relaxed);
+    for (unsigned int i = 0; i < INF_NUM_KEYS; i++) {
+        atomic_store_explicit (&stats->uploads_per_key[i], 0, memory_order_relaxed);
+    }
+}
+
+void stats_record (stats_histogram_t *histogram, uint64_t ns)
+{
+    stats_add (&histogram->count, 1);
+    stats_add (&histogram->total_ns, ns);
+    stats_add (&histogram->buckets[bucket_for_duration (ns)], 1);
+
+    uint64_t max = atomic_load_explicit (&histogram->max_ns, memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak_explicit (&histogram->max_ns, &max, ns,
+                                                               memory_order_relaxed,
+                                                               memory_order_relaxed));
+}
+
+void stats_snapshot (stats_t *stats, infdevice_stats_t *out_stats)
+{
+    memset (out_stats, 0, sizeof (infdevice_stats_t));
+
+    snapshot_histogram (&stats->encode, &out_stats->encode);
+    snapshot_histogram (&stats->write, &out_stats->write);
+    snapshot_histogram (&stats->pacing, &out_stats->pacing);
+    snapshot_histogram (&stats->feature, &out_stats->feature);
+    snapshot_histogram (&stats->read_wait, &out_stats->read_wait);
+
+    out_stats->bytes_sent = atomic_load_explicit (&stats->bytes_sent, memory_order_relaxed);
+    out_stats->failed_writes = atomic_load_explicit (&stats->failed_writes, memory_order_relaxed);
+    out_stats->short_writes = atomic_load_explicit (&stats->short_writes, memory_order_relaxed);
+    out_stats->read_timeouts = atomic_load_explicit (&stats->read_timeouts, memory_order_relaxed);
+    out_stats->skipped_uploads = atomic_load_explicit (&stats->skipped_uploads, memory_order_relaxed);
+    out_stats->skipped_reports = atomic_load_explicit (&stats->skipped_reports, memory_order_relaxed);
+    out_stats->disconnects = atomic_load_explicit (&stats->disconnects, memory_order_relaxed);
+    out_stats->reconnects = atomic_load_explicit (&stats->reconnects, memory_order_relaxed);
+    for (unsigned int i = 0; i < INF_NUM_KEYS; i++) {
+        out_stats->uploads_per_key[i] = atomic_load_explicit (&stats->uploads_per_key[i],
+                                                              memory_order_relaxed);
+    }
+}
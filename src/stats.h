@@ -0,0 +1,55 @@
+/*
+ * stats.h
+ *
+ * Counters and latency histograms behind `infdevice_get_stats`. Everything is a relaxed
+ * atomic, so recording never takes a lock and never stalls the upload path.
+ */
+
+#pragma once
+
+#include <infinitton/device.h>
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+typedef struct {
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t total_ns;
+    atomic_uint_fast64_t max_ns;
+    atomic_uint_fast64_t buckets[INF_STATS_HISTOGRAM_BUCKETS];
+} stats_histogram_t;
+
+typedef struct {
+    stats_histogram_t    encode;
+    stats_histogram_t    write;
+    stats_histogram_t    pacing;
+    stats_histogram_t    feature;
+    stats_histogram_t    read_wait;
+
+    atomic_uint_fast64_t bytes_sent;
+    atomic_uint_fast64_t failed_writes;
+    atomic_uint_fast64_t short_writes;
+    atomic_uint_fast64_t read_timeouts;
+    atomic_uint_fast64_t skipped_uploads;
+    atomic_uint_fast64_t skipped_reports;
+    atomic_uint_fast64_t disconnects;
+    atomic_uint_fast64_t reconnects;
+    atomic_uint_fast64_t uploads_per_key[INF_NUM_KEYS];
+} stats_t;
+
+// Monotonic clock in nanoseconds, for timing samples
+extern uint64_t stats_now_ns (void);
+
+extern void stats_reset (stats_t *stats);
+
+// Adds a duration sample to `histogram`
+extern void stats_record (stats_histogram_t *histogram, uint64_t ns);
+
+static inline void stats_add (atomic_uint_fast64_t *counter, uint64_t value)
+{
+    atomic_fetch_add_explicit (counter, value, memory_order_relaxed);
+}
+
+// Copies every counter into `out_stats`. Counters are read one by one, so a snapshot taken
+// while uploads are in flight may be off by the samples recorded in the meantime.
+extern void stats_snapshot (stats_t *stats, infdevice_stats_t *out_stats);
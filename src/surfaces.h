@@ -0,0 +1,19 @@
+/*
+ * surfaces.h
+ *
+ * Uploads of cairo surfaces converted straight into a device's report buffers, shared by the
+ * device and canvas code.
+ */
+
+#pragma once
+
+#include <infinitton/device.h>
+
+// Converts the surface of every key with one in `surfaces` (72x72 RGB24, indexed by key number,
+// NULL for keys to leave alone), turned by `orientation`, and sends those the keys don't already
+// show, all under one hold of the write lock. Returns the keys that were sent, and in `out_failed`,
+// if given, those whose upload didn't go through.
+extern infkey_t infdevice_upload_surfaces (infdevice_t      *device,
+                                           cairo_surface_t  *surfaces[INF_NUM_KEYS],
+                                           inforientation_t  orientation,
+                                           infkey_t         *out_failed);
@@ -0,0 +1,55 @@
+/*
+ * transport-debug.c
+ *
+ * Transport backend that writes every report to stdout, for running without a device
+ */
+
+#include "transport.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static int debug_write (inftransport_t *transport, const unsigned char *data, size_t len)
+{
+    return (fwrite (data, len, 1, stdout) == 1) ? (int) len : -1;
+}
+
+static int debug_read (inftransport_t *transport, unsigned char *data, size_t len, int timeout_ms)
+{
+    // No keys are ever pressed
+    if (timeout_ms < 0) {
+        for (;;) pause ();
+    }
+
+    usleep (timeout_ms * 1000);
+    return 0;
+}
+
+static int debug_get_fd (inftransport_t *transport)
+{
+    return -1;
+}
+
+static void debug_close (inftransport_t *transport)
+{
+    fflush (stdout);
+    free (transport);
+}
+
+static const inftransport_ops_t debug_ops = {
+    .name         = "debug",
+    .write        = debug_write,
+    .send_feature = debug_write,
+    .read         = debug_read,
+    .get_fd       = debug_get_fd,
+    .close        = debug_close,
+};
+
+inftransport_t* inftransport_debug_open (void)
+{
+    inftransport_t *transport = (inftransport_t *) malloc (sizeof (inftransport_t));
+    transport->ops = &debug_ops;
+
+    return transport;
+}
@@ -0,0 +1,119 @@
+/*
+ * transport-hidapi.c
+ *
+ * Transport backend using hidapi-libusb
+ */
+
+#include "transport.h"
+
+#include <hidapi/hidapi.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    inftransport_t  base;
+    hid_device     *hid_device;
+} hidapi_transport_t;
+
+static int hidapi_write (inftransport_t *transport, const unsigned char *data, size_t len)
+{
+    hidapi_transport_t *hidapi = (hidapi_transport_t *)transport;
+    return hid_write (hidapi->hid_device, data, len);
+}
+
+static int hidapi_send_feature (inftransport_t *transport, const unsigned char *data, size_t len)
+{
+    hidapi_transport_t *hidapi = (hidapi_transport_t *)transport;
+    return hid_send_feature_report (hidapi->hid_device, data, len);
+}
+
+static int hidapi_read (inftransport_t *transport, unsigned char *data, size_t len, int timeout_ms)
+{
+    hidapi_transport_t *hidapi = (hidapi_transport_t *)transport;
+    return hid_read_timeout (hidapi->hid_device, data, len, timeout_ms);
+}
+
+static int hidapi_get_fd (inftransport_t *transport)
+{
+    // libusb doesn't hand out a descriptor per device
+    return -1;
+}
+
+static void hidapi_close (inftransport_t *transport)
+{
+    hidapi_transport_t *hidapi = (hidapi_transport_t *)transport;
+    hid_close (hidapi->hid_device);
+    free (hidapi);
+}
+
+static const inftransport_ops_t hidapi_ops = {
+    .name         = "hidapi",
+    .write        = hidapi_write,
+    .send_feature = hidapi_send_feature,
+    .read         = hidapi_read,
+    .get_fd       = hidapi_get_fd,
+    .close        = hidapi_close,
+};
+
+// hid_init isn't safe to race, and otherwise runs implicitly on the first open
+static pthread_once_t hidapi_once = PTHREAD_ONCE_INIT;
+
+static void hidapi_init (void)
+{
+    hid_init ();
+}
+
+static void hidapi_init_once (void)
+{
+    pthread_once (&hidapi_once, hidapi_init);
+}
+
+size_t inftransport_hidapi_enumerate (infdevice_info_t *out_devices, size_t max_devices)
+{
+    hidapi_init_once ();
+
+    struct hid_device_info *devices = hid_enumerate (INF_VENDOR_ID, INF_PRODUCT_ID);
+
+    size_t count = 0;
+    for (struct hid_device_info *device = devices; device != NULL; device = device->next) {
+        if (count < max_devices) {
+            infdevice_info_t *info = &out_devices[count];
+            snprintf (info->path, sizeof (info->path), "%s", device->path);
+            if (device->serial_number == NULL
+                || snprintf (info->serial, sizeof (info->serial), "%ls", device->serial_number) < 0) {
+                info->serial[0] = '\0';
+            }
+        }
+        count++;
+    }
+
+    hid_free_enumeration (devices);
+
+    return count;
+}
+
+inftransport_t* inftransport_hidapi_open (const char *path)
+{
+    hidapi_init_once ();
+
+    hid_device *hid_device = NULL;
+    if (path == NULL) {
+        hid_device = hid_open (INF_VENDOR_ID, INF_PRODUCT_ID, NULL);
+    } else {
+        hid_device = hid_open_path (path);
+    }
+
+    if (hid_device == NULL) {
+        fprintf (stderr, "Unable to open device: %ls\n", hid_error (hid_device));
+        fprintf (stderr, "Check permissions?\n");
+        return NULL;
+    }
+
+    hidapi_transport_t *hidapi = (hidapi_transport_t *) malloc (sizeof (hidapi_transport_t));
+    hidapi->base.ops = &hidapi_ops;
+    hidapi->hid_device = hid_device;
+
+    return &hidapi->base;
+}
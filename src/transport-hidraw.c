@@ -0,0 +1,200 @@
+/*
+ * transport-hidraw.c
+ *
+ * Transport backend talking to the kernel's hidraw driver directly. Every report is
+ * a single write(2) or ioctl(2), and the device node itself can be polled for input.
+ */
+
+#include "transport.h"
+
+#include <linux/hidraw.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+typedef struct {
+    inftransport_t  base;
+    int             fd;
+} hidraw_transport_t;
+
+static int hidraw_write (inftransport_t *transport, const unsigned char *data, size_t len)
+{
+    hidraw_transport_t *hidraw = (hidraw_transport_t *)transport;
+
+    ssize_t result;
+    do {
+        result = write (hidraw->fd, data, len);
+    } while (result < 0 && errno == EINTR);
+
+    return (int) result;
+}
+
+static int hidraw_send_feature (inftransport_t *transport, const unsigned char *data, size_t len)
+{
+    hidraw_transport_t *hidraw = (hidraw_transport_t *)transport;
+
+    // The ioctl takes a non-const buffer, even though it only reads from it
+    unsigned char report[len];
+    memcpy (report, data, len);
+
+    return ioctl (hidraw->fd, HIDIOCSFEATURE (len), report);
+}
+
+static int hidraw_read (inftransport_t *transport, unsigned char *data, size_t len, int timeout_ms)
+{
+    hidraw_transport_t *hidraw = (hidraw_transport_t *)transport;
+
+    struct pollfd pfd = {
+        .fd = hidraw->fd,
+        .events = POLLIN
+    };
+
+    int ready = poll (&pfd, 1, timeout_ms);
+    if (ready < 0) {
+        return (errno == EINTR) ? 0 : -1;
+    } else if (ready == 0) {
+        return 0;
+    }
+
+    ssize_t result = read (hidraw->fd, data, len);
+    if (result < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return 0;
+    }
+
+    return (int) result;
+}
+
+static int hidraw_get_fd (inftransport_t *transport)
+{
+    hidraw_transport_t *hidraw = (hidraw_transport_t *)transport;
+    return hidraw->fd;
+}
+
+static void hidraw_close (inftransport_t *transport)
+{
+    hidraw_transport_t *hidraw = (hidraw_transport_t *)transport;
+    close (hidraw->fd);
+    free (hidraw);
+}
+
+static const inftransport_ops_t hidraw_ops = {
+    .name         = "hidraw",
+    .write        = hidraw_write,
+    .send_feature = hidraw_send_feature,
+    .read         = hidraw_read,
+    .get_fd       = hidraw_get_fd,
+    .close        = hidraw_close,
+};
+
+// Opens `path` if it is a keypad's hidraw node, otherwise returns -1
+static int open_keypad_node (const char *path)
+{
+    int fd = open (path, O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+        return -1;
+    }
+
+    fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+    struct hidraw_devinfo info;
+    if (ioctl (fd, HIDIOCGRAWINFO, &info) != 0
+        || (unsigned short) info.vendor != INF_VENDOR_ID
+        || (unsigned short) info.product != INF_PRODUCT_ID) {
+        close (fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// The serial number lives on the USB device, two levels above the HID device in sysfs
+static void read_serial (const char *node_name, char *serial, size_t size)
+{
+    serial[0] = '\0';
+
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "/sys/class/hidraw/%s/device/../../serial", node_name);
+
+    FILE *file = fopen (path, "r");
+    if (file == NULL) {
+        return;
+    }
+
+    if (fgets (serial, size, file) != NULL) {
+        serial[strcspn (serial, "\n")] = '\0';
+    }
+
+    fclose (file);
+}
+
+size_t inftransport_hidraw_enumerate (infdevice_info_t *out_devices, size_t max_devices)
+{
+    DIR *dev = opendir ("/dev");
+    if (dev == NULL) {
+        return 0;
+    }
+
+    size_t count = 0;
+    struct dirent *entry;
+    while ((entry = readdir (dev)) != NULL) {
+        if (strncmp (entry->d_name, "hidraw", strlen ("hidraw")) != 0) continue;
+
+        char path[sizeof ("/dev/") + sizeof (entry->d_name)];
+        snprintf (path, sizeof (path), "/dev/%s", entry->d_name);
+
+        // A node whose path doesn't fit can't be opened through its info either, so it is
+        // neither listed nor counted
+        const size_t path_length = strlen (path);
+        if (path_length >= sizeof (out_devices->path)) continue;
+
+        int fd = open_keypad_node (path);
+        if (fd < 0) continue;
+        close (fd);
+
+        if (count < max_devices) {
+            infdevice_info_t *info = &out_devices[count];
+            memcpy (info->path, path, path_length + 1);
+            read_serial (entry->d_name, info->serial, sizeof (info->serial));
+        }
+        count++;
+    }
+
+    closedir (dev);
+
+    return count;
+}
+
+inftransport_t* inftransport_hidraw_open (const char *path)
+{
+    infdevice_info_t first;
+    if (path == NULL) {
+        if (inftransport_hidraw_enumerate (&first, 1) == 0) {
+            fprintf (stderr, "Unable to find a keypad under /dev/hidraw*\n");
+            fprintf (stderr, "Check permissions?\n");
+            return NULL;
+        }
+
+        path = first.path;
+    }
+
+    int fd = open_keypad_node (path);
+    if (fd < 0) {
+        fprintf (stderr, "Unable to open keypad at %s\n", path);
+        fprintf (stderr, "Check permissions?\n");
+        return NULL;
+    }
+
+    hidraw_transport_t *hidraw = (hidraw_transport_t *) malloc (sizeof (hidraw_transport_t));
+    hidraw->base.ops = &hidraw_ops;
+    hidraw->fd = fd;
+
+    return &hidraw->base;
+}
@@ -0,0 +1,360 @@
+/*
+ * transport-mock.c
+ *
+ * Virtual keypad that decodes the reports it receives back into per-key images
+ */
+
+#include <infinitton/mock.h>
+
+#include "transport.h"
+#include "wire.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FEATURE_REPORT_ID     0x12
+#define INPUT_REPORT_ID       0x01
+#define IMAGE_SIZE            (ICON_WIDTH * ICON_HEIGHT * 3)
+
+// Largest BMP stream the staging buffer can take, both chunks' payloads
+#define MAX_STREAM_SIZE       (NUM_CHUNKS * CHUNK_PAYLOAD_SIZE)
+
+typedef struct {
+    inftransport_t   base;
+
+    pthread_mutex_t  lock;
+
+    // Image data reports land here until a commit copies them to a key
+    unsigned char    stream[MAX_STREAM_SIZE];
+
+    unsigned char    framebuffers[INF_NUM_KEYS][IMAGE_SIZE];
+    unsigned long    commit_counts[INF_NUM_KEYS];
+
+    infmock_report_t report_log[INF_MOCK_REPORT_LOG_SIZE];
+    unsigned long    report_count;
+
+    // Injected key states are written here as input reports
+    int              input_fds[2];
+} mock_transport_t;
+
+static const inftransport_ops_t mock_ops;
+
+// Returns the device's mock transport with a reference held, or NULL for real devices and while
+// a real device is disconnected. Give it back with `release_mock`.
+static mock_transport_t* mock_for_device (infdevice_t *device)
+{
+    inftransport_t *transport = infdevice_acquire_transport (device);
+    if (transport == NULL) {
+        return NULL;
+    }
+
+    if (transport->ops != &mock_ops) {
+        infdevice_release_transport (device, transport);
+        return NULL;
+    }
+
+    return (mock_transport_t *)transport;
+}
+
+static void release_mock (infdevice_t *device, mock_transport_t *mock)
+{
+    infdevice_release_transport (device, &mock->base);
+}
+
+static int32_t read_int32 (const unsigned char *data)
+{
+    int32_t value;
+    memcpy (&value, data, sizeof (value));
+    return value;
+}
+
+// Must be called with `lock` held
+static void log_report (mock_transport_t *mock, const unsigned char *data, size_t len, bool feature)
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    infmock_report_t *entry = &mock->report_log[mock->report_count % INF_MOCK_REPORT_LOG_SIZE];
+    *entry = (infmock_report_t) {
+        .timestamp_ns = (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec,
+        .report_id = (len > 0) ? data[0] : 0,
+        .length = len,
+        .feature = feature
+    };
+
+    mock->report_count++;
+}
+
+static int mock_write (inftransport_t *transport, const unsigned char *data, size_t len)
+{
+    mock_transport_t *mock = (mock_transport_t *)transport;
+    if (len < CHUNK_HEADER_SIZE || data[0] != REPORT_ID) {
+        return -1;
+    }
+
+    binary_data_partial_t header;
+    memcpy (&header, data + 1, sizeof (header));
+
+    // The second chunk's length counts its header as well
+    size_t length = header.length;
+    if (header.offset > 0 && length >= sizeof (header)) {
+        length -= sizeof (header);
+    }
+
+    if (header.offset < 0 || (size_t) header.offset >= MAX_STREAM_SIZE) {
+        return -1;
+    }
+
+    if (length > len - CHUNK_HEADER_SIZE) {
+        length = len - CHUNK_HEADER_SIZE;
+    }
+    if (length > MAX_STREAM_SIZE - (size_t) header.offset) {
+        length = MAX_STREAM_SIZE - (size_t) header.offset;
+    }
+
+    pthread_mutex_lock (&mock->lock);
+    memcpy (mock->stream + header.offset, data + CHUNK_HEADER_SIZE, length);
+    log_report (mock, data, len, false);
+    pthread_mutex_unlock (&mock->lock);
+
+    return (int) len;
+}
+
+static int mock_send_feature (inftransport_t *transport, const unsigned char *data, size_t len)
+{
+    mock_transport_t *mock = (mock_transport_t *)transport;
+    if (len < 20 || data[0] != FEATURE_REPORT_ID) {
+        return -1;
+    }
+
+    // Key numbers in commits are 1-based
+    const int32_t screen_num = read_int32 (data + 4);
+    const int32_t stream_size = read_int32 (data + 16);
+    if (screen_num < 1 || screen_num > INF_NUM_KEYS) {
+        return -1;
+    }
+
+    pthread_mutex_lock (&mock->lock);
+
+    // Image data starts where the staged stream's BMP header says it does
+    int32_t data_offset = read_int32 (mock->stream + 10);
+    if (data_offset < 0 || (size_t) data_offset + IMAGE_SIZE > MAX_STREAM_SIZE
+        || data_offset + IMAGE_SIZE > stream_size) {
+        data_offset = stream_size - IMAGE_SIZE;
+    }
+
+    if (data_offset >= 0 && (size_t) data_offset + IMAGE_SIZE <= MAX_STREAM_SIZE) {
+        memcpy (mock->framebuffers[screen_num - 1], mock->stream + data_offset, IMAGE_SIZE);
+        mock->commit_counts[screen_num - 1]++;
+    }
+
+    log_report (mock, data, len, true);
+
+    pthread_mutex_unlock (&mock->lock);
+
+    return (int) len;
+}
+
+static int mock_read (inftransport_t *transport, unsigned char *data, size_t len, int timeout_ms)
+{
+    mock_transport_t *mock = (mock_transport_t *)transport;
+
+    struct pollfd pfd = {
+        .fd = mock->input_fds[0],
+        .events = POLLIN
+    };
+
+    int ready = poll (&pfd, 1, timeout_ms);
+    if (ready < 0) {
+        return (errno == EINTR) ? 0 : -1;
+    } else if (ready == 0) {
+        return 0;
+    }
+
+    unsigned char report[3];
+    ssize_t result = read (mock->input_fds[0], report, sizeof (report));
+    if (result < 0) {
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+
+    if ((size_t) result > len) {
+        result = len;
+    }
+    memcpy (data, report, result);
+
+    return (int) result;
+}
+
+static int mock_get_fd (inftransport_t *transport)
+{
+    mock_transport_t *mock = (mock_transport_t *)transport;
+    return mock->input_fds[0];
+}
+
+static void mock_close (inftransport_t *transport)
+{
+    mock_transport_t *mock = (mock_transport_t *)transport;
+
+    close (mock->input_fds[0]);
+    close (mock->input_fds[1]);
+    pthread_mutex_destroy (&mock->lock);
+    free (mock);
+}
+
+static const inftransport_ops_t mock_ops = {
+    .name         = "mock",
+    .write        = mock_write,
+    .send_feature = mock_send_feature,
+    .read         = mock_read,
+    .get_fd       = mock_get_fd,
+    .close        = mock_close,
+};
+
+inftransport_t* inftransport_mock_open (void)
+{
+    mock_transport_t *mock = (mock_transport_t *) calloc (1, sizeof (mock_transport_t));
+    if (mock == NULL) {
+        return NULL;
+    }
+
+    if (pipe (mock->input_fds) != 0) {
+        free (mock);
+        return NULL;
+    }
+
+    for (unsigned int i = 0; i < 2; i++) {
+        fcntl (mock->input_fds[i], F_SETFL, fcntl (mock->input_fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl (mock->input_fds[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    mock->base.ops = &mock_ops;
+    pthread_mutex_init (&mock->lock, NULL);
+
+    return &mock->base;
+}
+
+bool infmock_is_mock (infdevice_t *device)
+{
+    mock_transport_t *mock = mock_for_device (device);
+    if (mock == NULL) {
+        return false;
+    }
+
+    release_mock (device, mock);
+    return true;
+}
+
+bool infmock_get_framebuffer (infdevice_t *device, infkey_t key_id, unsigned char *out_image)
+{
+    const int keynum = infkey_to_key_num (key_id);
+    if (keynum < 0 || keynum >= INF_NUM_KEYS) {
+        return false;
+    }
+
+    mock_transport_t *mock = mock_for_device (device);
+    if (mock == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock (&mock->lock);
+    const bool committed = (mock->commit_counts[keynum] > 0);
+    if (committed) {
+        memcpy (out_image, mock->framebuffers[keynum], IMAGE_SIZE);
+    }
+    pthread_mutex_unlock (&mock->lock);
+
+    release_mock (device, mock);
+
+    return committed;
+}
+
+unsigned long infmock_get_commit_count (infdevice_t *device, infkey_t key_id)
+{
+    const int keynum = infkey_to_key_num (key_id);
+    if (keynum < 0 || keynum >= INF_NUM_KEYS) {
+        return 0;
+    }
+
+    mock_transport_t *mock = mock_for_device (device);
+    if (mock == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock (&mock->lock);
+    unsigned long count = mock->commit_counts[keynum];
+    pthread_mutex_unlock (&mock->lock);
+
+    release_mock (device, mock);
+
+    return count;
+}
+
+size_t infmock_get_reports (infdevice_t *device, infmock_report_t *out_reports, size_t max_reports)
+{
+    mock_transport_t *mock = mock_for_device (device);
+    if (mock == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock (&mock->lock);
+
+    size_t available = mock->report_count;
+    if (available > INF_MOCK_REPORT_LOG_SIZE) {
+        available = INF_MOCK_REPORT_LOG_SIZE;
+    }
+
+    const size_t count = (max_reports < available) ? max_reports : available;
+    const unsigned long first = mock->report_count - count;
+    for (size_t i = 0; i < count; i++) {
+        out_reports[i] = mock->report_log[(first + i) % INF_MOCK_REPORT_LOG_SIZE];
+    }
+
+    pthread_mutex_unlock (&mock->lock);
+
+    release_mock (device, mock);
+
+    return count;
+}
+
+unsigned long infmock_get_report_count (infdevice_t *device)
+{
+    mock_transport_t *mock = mock_for_device (device);
+    if (mock == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock (&mock->lock);
+    unsigned long count = mock->report_count;
+    pthread_mutex_unlock (&mock->lock);
+
+    release_mock (device, mock);
+
+    return count;
+}
+
+void infmock_inject_key (infdevice_t *device, infkey_t key_state)
+{
+    mock_transport_t *mock = mock_for_device (device);
+    if (mock == NULL) {
+        return;
+    }
+
+    // Same layout as the keypad's input report: report id, then a 16-bit key state
+    const uint16_t state = key_state;
+    unsigned char report[3] = { INPUT_REPORT_ID };
+    memcpy (report + 1, &state, sizeof (state));
+
+    if (write (mock->input_fds[1], report, sizeof (report)) != sizeof (report)) {
+        fprintf (stderr, "Mock input queue is full, dropping key event\n");
+    }
+
+    release_mock (device, mock);
+}
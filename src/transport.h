@@ -0,0 +1,70 @@
+/*
+ * transport.h
+ *
+ * Interface between the device layer and whatever actually moves reports to the
+ * keypad. Each backend embeds `inftransport_t` as its first member.
+ */
+
+#pragma once
+
+#include <infinitton/device.h>
+
+#include <stddef.h>
+
+#define INF_VENDOR_ID   0xFFFF
+#define INF_PRODUCT_ID  0x1F40
+
+struct inftransport_t_;
+typedef struct inftransport_t_ inftransport_t;
+
+// `write` and `send_feature` are only ever called by one thread at a time, but `read` and
+// `get_fd` may be called from other threads while a write is in progress. Backends must not
+// make one wait for the other.
+typedef struct {
+    const char *name;
+
+    // Each returns the number of bytes transferred, or -1 on error
+    int  (*write)        (inftransport_t *transport, const unsigned char *data, size_t len);
+    int  (*send_feature) (inftransport_t *transport, const unsigned char *data, size_t len);
+
+    // Waits at most `timeout_ms` (-1 forever) for an input report. Returns its length,
+    // 0 on timeout, or -1 on error.
+    int  (*read)         (inftransport_t *transport, unsigned char *data, size_t len, int timeout_ms);
+
+    // Returns a descriptor that polls readable when an input report is waiting, or -1
+    // if the backend doesn't have one.
+    int  (*get_fd)       (inftransport_t *transport);
+
+    void (*close)        (inftransport_t *transport);
+} inftransport_ops_t;
+
+struct inftransport_t_ {
+    const inftransport_ops_t *ops;
+
+    // References held by the device layer, backends leave this alone
+    unsigned int              refs;
+};
+
+// Open the keypad at `path` through hidapi-libusb, or the first one if `path` is NULL
+extern inftransport_t* inftransport_hidapi_open (const char *path);
+
+// Open the keypad at `path` through the kernel's /dev/hidraw interface, or the first one
+// if `path` is NULL
+extern inftransport_t* inftransport_hidraw_open (const char *path);
+
+// Fill in up to `max_devices` keypads visible to each backend, returning how many there are
+extern size_t inftransport_hidapi_enumerate (infdevice_info_t *out_devices, size_t max_devices);
+extern size_t inftransport_hidraw_enumerate (infdevice_info_t *out_devices, size_t max_devices);
+
+// Dumps every report to stdout instead of talking to a device, see util_debugging_enabled
+extern inftransport_t* inftransport_debug_open (void);
+
+// A virtual device decoding reports in memory, see infinitton/mock.h
+extern inftransport_t* inftransport_mock_open (void);
+
+// Returns the transport a device is currently using with a reference held, so it stays open even
+// if the keypad reconnects meanwhile, or NULL while it is disconnected. Give the reference back
+// with `infdevice_release_transport`.
+extern inftransport_t* infdevice_acquire_transport (infdevice_t *device);
+
+extern void infdevice_release_transport (infdevice_t *device, inftransport_t *transport);
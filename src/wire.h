@@ -0,0 +1,93 @@
+/*
+ * wire.h
+ *
+ * Layout of the HID reports that carry image data to the device. Shared by the
+ * device and pixmap code so pixmaps can be stored directly in this layout.
+ */
+
+#pragma once
+
+#include <infinitton/pixmap.h>
+
+#include <stdint.h>
+#include <string.h>
+
+typedef struct __attribute__((__packed__)) {
+    int32_t offset;
+    int32_t length; // 0x1f40
+
+    int32_t ctrl1;  // 0x55aaaa55
+    int32_t ctrl2;  // 0x44332211
+} binary_data_partial_t;
+
+// Image data is sent as two 0x02 output reports, each a header followed by up to
+// 8000 bytes of the BMP stream, then committed to a key with a feature report.
+#define REPORT_ID           0x02
+#define NUM_CHUNKS          2
+#define CHUNK_PAYLOAD_SIZE  8000
+#define CHUNK_HEADER_SIZE   (sizeof (binary_data_partial_t) + 1)
+#define CHUNK_SIZE          (CHUNK_PAYLOAD_SIZE + CHUNK_HEADER_SIZE)
+
+typedef struct {
+    unsigned char chunks[NUM_CHUNKS][CHUNK_SIZE];
+} __attribute__((aligned (64))) frame_reports_t;
+
+// The bytes of a frame that are sent, without the alignment padding after the chunks, which
+// nothing ever writes and so must not be hashed or compared
+#define FRAME_REPORTS_SIZE  (NUM_CHUNKS * CHUNK_SIZE)
+
+// Writes the report id and header of both chunks for a BMP stream of `stream_size` bytes
+static inline void wire_write_headers (frame_reports_t *reports, size_t stream_size)
+{
+    binary_data_partial_t header = {
+        .offset = 0,
+        .length = CHUNK_PAYLOAD_SIZE,
+        .ctrl1  = 0x55aaaa55,
+        .ctrl2  = 0x44332211
+    };
+
+    for (unsigned int i = 0; i < NUM_CHUNKS; i++) {
+        unsigned char *payload = reports->chunks[i];
+
+        // The second header's length covers the header too, matching what the
+        // vendor software sends.
+        if (i > 0) {
+            header.offset = CHUNK_PAYLOAD_SIZE;
+            header.length = sizeof (header) + stream_size - CHUNK_PAYLOAD_SIZE;
+        }
+
+        payload[0] = REPORT_ID;
+        memcpy (payload + 1, &header, sizeof (header));
+    }
+}
+
+// Returns the report buffer of a pixmap created with `infpixmap_create_wire`, or NULL if
+// the pixmap is stored as a plain BMP stream. `out_stream_size` receives the stream's size.
+extern frame_reports_t* infpixmap_get_wire_reports (infpixmap_t *pixmap, size_t *out_stream_size);
+
+// Fills `reports` with a complete frame converted from `surface` (a 72x72 RGB24 cairo surface),
+// turned by `orientation`, and returns the size of the BMP stream to commit.
+extern size_t wire_encode_surface (frame_reports_t  *reports,
+                                   cairo_surface_t  *surface,
+                                   inforientation_t  orientation);
+
+// Finds the part of a 72x72 surface that ends up in report `chunk` when it is encoded with
+// `orientation`: either a band of whole rows or one of whole columns. The line of pixels split
+// between the two reports belongs to both.
+extern void wire_chunk_source_rect (unsigned int      chunk,
+                                    inforientation_t  orientation,
+                                    unsigned int     *out_x,
+                                    unsigned int     *out_y,
+                                    unsigned int     *out_width,
+                                    unsigned int     *out_height);
+
+// Returns `count` wire pixmaps that use `frames` as their buffers, one each, in a single
+// allocation. The frames stay owned by the caller and must hold complete streams, as written by
+// `wire_encode_surface`. `infpixmap_free` does nothing to a view; release them all at once
+// with `wire_free_views`.
+extern infpixmap_t* wire_create_views (frame_reports_t *frames, size_t count);
+
+// Returns the view over frame `index`
+extern infpixmap_t* wire_view_at (infpixmap_t *views, size_t index);
+
+extern void wire_free_views (infpixmap_t *views);